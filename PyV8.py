@@ -7,19 +7,24 @@ import sys
 import os
 import re
 import logging
+import functools
+import threading
 import collections
 
 is_py3k = sys.version_info[0] > 2
 
 if is_py3k:
     import _thread as thread
+    import queue
 
     from io import StringIO
 
     unicode = str
+    basestring = str
     raw_input = input
 else:
     import thread
+    import Queue as queue
 
 try:
     from cStringIO import StringIO
@@ -31,6 +36,12 @@ try:
 except ImportError:
     import simplejson as json
 
+try:
+    from concurrent.futures import TimeoutError as FutureTimeoutError
+except ImportError:
+    class FutureTimeoutError(Exception):
+        pass
+
 if __name__ == '__main__':
     if "-p" in sys.argv:
         sys.argv.remove("-p")
@@ -43,9 +54,11 @@ __author__ = 'Flier Lu <flier.lu@gmail.com>'
 __version__ = '1.0'
 
 __all__ = ["ReadOnly", "DontEnum", "DontDelete", "Internal",
-           "JSError", "JSObject", "JSNull", "JSUndefined", "JSArray", "JSFunction",
+           "JSError", "JSTimeoutError", "JSObject", "JSNull", "JSUndefined", "JSArray", "JSFunction",
            "JSClass", "JSEngine", "JSContext", "JSIsolate",
-           "JSStackTrace", "JSStackFrame", "JSExtension", "JSLocker", "JSUnlocker"]
+           "JSStackTrace", "JSStackFrame", "JSExtension", "JSLocker", "JSUnlocker",
+           "JSFuture", "FutureTimeoutError", "JSIsolatePool", "JSIsolateThread", "JSPromise", "JSPromiseState", "JSMicrotaskPolicy",
+           "JSProfiler", "JSProfile", "JSHeapProfiler", "toPython", "fromPython", "toJSON"]
 
 SUPPORT_AST = hasattr(_PyV8, 'AstScope')
 SUPPORT_DEBUGGER = hasattr(_PyV8, 'JSDebug')
@@ -132,13 +145,64 @@ class JSError(Exception):
     def frames(self):
         return self.parse_stack(self.stackTrace)
 
+    def detach(self):
+        """Returns a JSError holding a copy of the details, which outlives the isolate and may be read by any thread."""
+        return JSError(JSErrorInfo(self))
+
 _PyV8._JSError._jsclass = JSError
 
+
+class JSErrorInfo(object):
+    """The details of a JSError copied from its isolate."""
+
+    FIELDS = ('name', 'message', 'scriptName', 'lineNum', 'startPos', 'endPos',
+              'startCol', 'endCol', 'sourceLine', 'stackTrace')
+
+    def __init__(self, err):
+        for field in self.FIELDS:
+            setattr(self, field, getattr(err, field))
+
+        self._str = str(err)
+
+        if not is_py3k:
+            self._unicode = unicode(err)
+
+    def __str__(self):
+        return self._str
+
+    def __unicode__(self):
+        return self._unicode
+
+    def print_tb(self, file=None):
+        print(self.stackTrace, file=file or sys.stdout)
+
+
+def _detach_error(e):
+    return e.detach() if isinstance(e, JSError) else e
+
+def _detach_result(value):
+    if isinstance(value, _PyV8.JSFunction):
+        return str(value)
+
+    if isinstance(value, _PyV8.JSObject):
+        return toPython(value)
+
+    return value
+
+JSTimeoutError = _PyV8.JSTimeoutError
+
 JSObject = _PyV8.JSObject
 JSNull = _PyV8.JSNull
 JSUndefined = _PyV8.JSUndefined
 JSArray = _PyV8.JSArray
 JSFunction = _PyV8.JSFunction
+JSPromise = _PyV8.JSPromise
+JSPromiseState = _PyV8.JSPromiseState
+
+# module functions, so they never shadow the properties of Javascript objects
+toPython = _PyV8.toPython
+fromPython = _PyV8.fromPython
+toJSON = _PyV8.toJSON
 
 # contribute by e.generalov
 
@@ -208,6 +272,17 @@ class JSUnlocker(_PyV8.JSUnlocker):
     def __exit__(self, exc_type, exc_value, traceback):
         self.leave()
 
+    @staticmethod
+    def blocking(func):
+        """Decorate a Python callback that blocks (e.g. on I/O) without touching any Javascript object,
+        the isolate is handed to the next waiting thread while it runs."""
+        @functools.wraps(func)
+        def wrapper(*args, **kwds):
+            with JSUnlocker():
+                return func(*args, **kwds)
+
+        return wrapper
+
     if is_py3k:
         def __bool__(self):
             return self.entered()
@@ -776,6 +851,9 @@ JSStackTrace.GetCurrentStackTrace = staticmethod(lambda frame_limit, options: _P
 JSStackFrame = _PyV8.JSStackFrame
 
 
+JSMicrotaskPolicy = _PyV8.JSMicrotaskPolicy
+
+
 class JSIsolate(_PyV8.JSManagedIsolate):
     def __enter__(self):
         self.enter()
@@ -792,16 +870,159 @@ class JSIsolate(_PyV8.JSManagedIsolate):
         del self
 
 
+JSProfileEntry = collections.namedtuple('JSProfileEntry', ['function', 'script', 'line', 'self_time', 'total_time'])
+
+
+class JSProfile(object):
+    """
+    A CPU profile collected by JSProfiler, in the layout of the Chrome DevTools .cpuprofile format.
+
+    The times are in seconds, the self time of a function is estimated from its share of the samples.
+    """
+    def __init__(self, profile):
+        self.profile = profile
+        self.nodes = dict((node['id'], node) for node in profile['nodes'])
+
+        hits = sum(node['hitCount'] for node in profile['nodes'])
+
+        self.interval = self.duration / hits if hits else 0
+
+    @property
+    def title(self):
+        return self.profile['title']
+
+    @property
+    def duration(self):
+        return (self.profile['endTime'] - self.profile['startTime']) / 1e6
+
+    @property
+    def tree(self):
+        def build(node):
+            frame = node['callFrame']
+            children = [build(self.nodes[child]) for child in node['children']]
+            self_time = node['hitCount'] * self.interval
+
+            return {
+                'function': frame['functionName'] or '(anonymous)',
+                'script': frame['url'],
+                'line': frame['lineNumber'] + 1,
+                'self_time': self_time,
+                'total_time': self_time + sum(child['total_time'] for child in children),
+                'children': children,
+            }
+
+        return build(self.profile['nodes'][0])
+
+    def flat(self):
+        """Returns a list of JSProfileEntry, one per function, ordered by the self time."""
+        entries = {}
+        active = collections.defaultdict(int)
+
+        def walk(node):
+            key = (node['function'], node['script'], node['line'])
+            self_time, total_time = entries.get(key, (0, 0))
+
+            # don't count the recursive calls twice
+            entries[key] = (self_time + node['self_time'], total_time + (0 if active[key] else node['total_time']))
+
+            active[key] += 1
+
+            for child in node['children']:
+                walk(child)
+
+            active[key] -= 1
+
+        for child in self.tree['children']:
+            walk(child)
+
+        return sorted([JSProfileEntry(function, script, line, self_time, total_time)
+                       for (function, script, line), (self_time, total_time) in entries.items()],
+                      key=lambda entry: entry.self_time, reverse=True)
+
+    def json(self):
+        return json.dumps(self.profile)
+
+    def save(self, file):
+        """Save the profile to a .cpuprofile file, which can be loaded by Chrome DevTools."""
+        if isinstance(file, basestring):
+            with open(file, 'w') as f:
+                f.write(self.json())
+        else:
+            file.write(self.json())
+
+
+class JSProfiler(_PyV8.JSProfiler):
+    def stop(self):
+        profile = _PyV8.JSProfiler.stop(self)
+
+        return JSProfile(profile) if profile else None
+
+    def __enter__(self):
+        self.start()
+
+        return self
+
+    def __exit__(self, exc_type, exc_value, tb):
+        self.profile = self.stop()
+
+
+class JSHeapProfiler(_PyV8.JSHeapProfiler):
+    def takeSnapshot(self, file):
+        """Write a heap snapshot to the binary file object or path, which can be loaded by Chrome DevTools."""
+        if isinstance(file, basestring):
+            with open(file, 'wb') as f:
+                _PyV8.JSHeapProfiler.takeSnapshot(self, f)
+        else:
+            _PyV8.JSHeapProfiler.takeSnapshot(self, file)
+
+
 class JSContext(_PyV8.JSContext):
     def __init__(self, obj=None, extensions=None, ctxt=None):
-        if JSLocker.active:
-            self.lock = JSLocker()
-            self.lock.enter()
+        # once any thread uses a JSLocker, the isolate is only locked while the context is created or entered
+        self._locks = []
+        self._isolate = JSIsolate.current
 
-        if ctxt:
-            _PyV8.JSContext.__init__(self, ctxt)
-        else:
-            _PyV8.JSContext.__init__(self, obj, extensions or [])
+        lock = JSLocker() if JSLocker.active else None
+
+        if lock:
+            lock.enter()
+
+        try:
+            if ctxt:
+                _PyV8.JSContext.__init__(self, ctxt)
+            else:
+                _PyV8.JSContext.__init__(self, obj, extensions or [])
+        finally:
+            if lock:
+                lock.leave()
+
+    def enter(self):
+        lock = JSLocker() if JSLocker.active else None
+
+        if lock:
+            lock.enter()
+
+        try:
+            _PyV8.JSContext.enter(self)
+        except:
+            if lock:
+                lock.leave()
+
+            raise
+
+        self._locks.append(lock)
+
+    def leave(self):
+        _PyV8.JSContext.leave(self)
+
+        lock = self._locks.pop() if self._locks else None
+
+        if lock:
+            lock.leave()
+
+    def eval_async(self, source, converter=None, loop=None):
+        """Evaluate the script on the thread of the isolate, returns an asyncio future of the result."""
+        return JSIsolateThread.get(self._isolate).submit(loop, converter, self, self.eval, source)
 
     def __enter__(self):
         self.enter()
@@ -811,10 +1032,6 @@ class JSContext(_PyV8.JSContext):
     def __exit__(self, exc_type, exc_value, tb):
         self.leave()
 
-        if hasattr(JSLocker, 'lock'):
-            self.lock.leave()
-            self.lock = None
-
         if exc_type:
             logging.warn("throw exceptions in %r", self)
             logging.debug(''.join(traceback.format_exception(exc_type, exc_value, tb)))
@@ -824,13 +1041,351 @@ class JSContext(_PyV8.JSContext):
         del self
 
 
+class JSFuture(object):
+    """The pending result of a job submitted to the JSIsolatePool."""
+
+    def __init__(self):
+        self._finished = threading.Event()
+        self._result = None
+        self._exception = None
+
+    def done(self):
+        return self._finished.is_set()
+
+    def result(self, timeout=None):
+        if not self._finished.wait(timeout) and not self._finished.is_set():
+            raise FutureTimeoutError("Job not finished after %s seconds" % timeout)
+
+        if self._exception is not None:
+            raise self._exception
+
+        return self._result
+
+    def exception(self, timeout=None):
+        if not self._finished.wait(timeout) and not self._finished.is_set():
+            raise FutureTimeoutError("Job not finished after %s seconds" % timeout)
+
+        return self._exception
+
+    def set_result(self, result):
+        self._result = result
+        self._finished.set()
+
+    def set_exception(self, exception):
+        self._exception = exception
+        self._finished.set()
+
+
+class JSIsolatePool(object):
+    """
+    A pool of isolates, each one pinned to a worker thread with a pre-warmed context,
+    optional created from the startup snapshot of JSEngine.createSnapshot.
+
+    The jobs are evaluated in the first idle context, the script result is called with
+    the arguments when given, and the return value is converted to Python objects
+    before it leaves the worker, because the JavaScript objects belong to its isolate.
+    The objects left by the converter are converted too, the functions to their source.
+    """
+
+    def __init__(self, size=None, obj=None, extensions=None, warmup=None, factory=None, converter=None, snapshot=None):
+        if size is None:
+            import multiprocessing
+
+            size = multiprocessing.cpu_count()
+
+        if size < 1:
+            raise ValueError("Pool size should be positive")
+
+        self.size = size
+        self.obj = obj
+        self.extensions = extensions
+        self.warmup = warmup
+        self.factory = factory
+        self.converter = converter or convert
+        self.snapshot = snapshot
+
+        self._jobs = queue.Queue()
+        self._workers = []
+        self._closed = False
+
+        ready = [JSFuture() for i in range(size)]
+
+        for i in range(size):
+            worker = threading.Thread(target=self._serve, args=(ready[i],), name="JSIsolatePool-%d" % i)
+            worker.daemon = True
+            worker.start()
+
+            self._workers.append(worker)
+
+        try:
+            for future in ready:
+                future.result()
+        except Exception:
+            self.close()
+
+            raise
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    def __len__(self):
+        return self.size
+
+    @property
+    def pending(self):
+        """the number of jobs waiting for an idle isolate"""
+        return self._jobs.qsize()
+
+    def submit(self, script, *args):
+        """Evaluate the script in an idle context, and call its result with the arguments if any."""
+        if self._closed:
+            raise RuntimeError("Submit job to a closed pool")
+
+        future = JSFuture()
+
+        self._jobs.put((future, script, args))
+
+        return future
+
+    def map(self, script, *iterables):
+        """Call the function evaluated from script for each group of arguments, in parallel."""
+        futures = [self.submit(script, *args) for args in zip(*iterables)]
+
+        return [future.result() for future in futures]
+
+    def close(self, wait=True):
+        """Stop the workers after the submitted jobs are finished."""
+        if not self._closed:
+            self._closed = True
+
+            for worker in self._workers:
+                self._jobs.put(None)
+
+        if wait:
+            for worker in self._workers:
+                if worker is not threading.current_thread():
+                    worker.join()
+
+    def _serve(self, ready):
+        isolate = JSIsolate(self.snapshot)
+
+        locker = JSLocker(isolate)
+        locker.enter()
+
+        isolate.enter()
+
+        try:
+            try:
+                ctxt = JSContext(self.factory() if self.factory else self.obj, self.extensions)
+
+                ctxt.enter()
+
+                if self.warmup:
+                    ctxt.eval(self.warmup)
+            except Exception as e:
+                ready.set_exception(_detach_error(e))
+
+                return
+
+            ready.set_result(True)
+
+            try:
+                while True:
+                    job = self._jobs.get()
+
+                    if job is None:
+                        break
+
+                    future, script, args = job
+
+                    try:
+                        result = ctxt.eval(script)
+
+                        if args:
+                            result = result(*args)
+
+                        future.set_result(_detach_result(self.converter(result)))
+                    except Exception as e:
+                        # the JSError refers to the isolate of this worker
+                        future.set_exception(_detach_error(e))
+
+                    job = future = script = args = result = None
+            finally:
+                ctxt.leave()
+
+                del ctxt
+        finally:
+            isolate.leave()
+            locker.leave()
+
+            del locker, isolate
+
+
+class JSIsolateThread(object):
+    """
+    A dedicated thread running the scripts of an isolate for asyncio, so the event loop
+    awaits the results instead of blocking on (or burning an executor slot for) each call.
+
+    The isolate is only locked while a job runs. When the result is a Promise, the future
+    is resolved once the promise is settled. The Javascript objects are returned as is,
+    and wrapped lazily when the caller touches them, which needs the isolate lock again
+    (e.g. entering the context); pass a converter to get Python objects instead.
+    Never await a job while holding the lock of its isolate. Under the explicit microtask
+    policy, the promises are only settled by the checkpoints of JSIsolate.runMicrotasks().
+    """
+
+    _threads = {}
+    _lock = threading.Lock()
+
+    def __init__(self, isolate):
+        self.isolate = isolate
+
+        self._jobs = queue.Queue()
+        self._thread = threading.Thread(target=self._serve, name="JSIsolateThread")
+        self._thread.daemon = True
+        self._thread.start()
+
+    @classmethod
+    def get(cls, isolate=None):
+        """Returns the thread of the isolate (the current one by default), started on demand."""
+        if isolate is None:
+            isolate = JSIsolate.current
+
+        with cls._lock:
+            thread = cls._threads.get(isolate)
+
+            if thread is None:
+                thread = cls._threads[isolate] = cls(isolate)
+
+            return thread
+
+    @classmethod
+    def stop(cls, isolate=None, wait=True):
+        """Stops the thread of the isolate after the submitted jobs, it must be stopped before disposing the isolate."""
+        if isolate is None:
+            isolate = JSIsolate.current
+
+        with cls._lock:
+            thread = cls._threads.pop(isolate, None)
+
+        if thread:
+            thread._jobs.put(None)
+
+            if wait and thread._thread is not threading.current_thread():
+                thread._thread.join()
+
+    def submit(self, loop, converter, ctxt, func, *args):
+        """Call the function in the context (or the creation context of a Javascript object) on the thread."""
+        import asyncio
+
+        loop = loop or asyncio.get_event_loop()
+        future = loop.create_future()
+
+        self._jobs.put((loop, future, converter, ctxt, func, args))
+
+        return future
+
+    @staticmethod
+    def _settle(loop, future, result=None, exception=None):
+        def settle():
+            if future.done():
+                pass
+            elif exception is not None:
+                future.set_exception(exception)
+            else:
+                future.set_result(result)
+
+        try:
+            loop.call_soon_threadsafe(settle)
+        except RuntimeError:
+            pass # the loop was closed
+
+    @staticmethod
+    def _rejected(reason):
+        try:
+            JSContext.current.eval("(function (e) { throw e; })")(reason)
+        except JSError as e:
+            return e
+
+    def _serve(self):
+        while True:
+            job = self._jobs.get()
+
+            if job is None:
+                break
+
+            loop, future, converter, ctxt, func, args = job
+
+            locker = JSLocker(self.isolate)
+            locker.enter()
+
+            self.isolate.enter()
+
+            try:
+                if not isinstance(ctxt, _PyV8.JSContext):
+                    ctxt = ctxt.context
+
+                _PyV8.JSContext.enter(ctxt)
+
+                try:
+                    self._run(loop, future, converter or (lambda value: value), func, args)
+                finally:
+                    _PyV8.JSContext.leave(ctxt)
+            finally:
+                self.isolate.leave()
+                locker.leave()
+
+            job = loop = future = converter = ctxt = func = args = None
+
+    def _run(self, loop, future, converter, func, args):
+        # the errors are detached on the isolate thread, the loop reads them without the isolate lock
+        def settle(convert, value):
+            try:
+                result = convert(value)
+            except Exception as e:
+                self._settle(loop, future, exception=_detach_error(e))
+            else:
+                self._settle(loop, future, result)
+
+        def raise_rejected(reason):
+            raise self._rejected(reason)
+
+        try:
+            result = func(*args)
+
+            if isinstance(result, JSPromise):
+                # a callback raising would only reject the derived promise, and leave the future pending
+                result.then(lambda value: settle(converter, value),
+                            lambda reason: settle(raise_rejected, reason))
+            else:
+                settle(converter, result)
+        except Exception as e:
+            self._settle(loop, future, exception=_detach_error(e))
+
+
+def _call_async(self, *args, **kwds):
+    """Call the function on the thread of the isolate, returns an asyncio future of the result."""
+    loop = kwds.pop('loop', None)
+    converter = kwds.pop('converter', None)
+
+    if kwds:
+        raise TypeError("unexpected keyword arguments: %s" % ', '.join(kwds))
+
+    return JSIsolateThread.get().submit(loop, converter, self, self, *args)
+
+JSFunction.call_async = _call_async
+
+if is_py3k:
+    JSPromise.__await__ = lambda self: JSIsolateThread.get().submit(None, None, self, lambda: self).__await__()
+
+
 # contribute by marc boeker <http://code.google.com/u/marc.boeker/>
 def convert(obj):
-    if type(obj) == _PyV8.JSArray:
-        return [convert(v) for v in obj]
-
-    if type(obj) == _PyV8.JSObject:
-        return dict([[str(k), convert(obj.__getattr__(str(k)))] for k in (obj.__dir__() if is_py3k else obj.__members__)])
+    if type(obj) in (_PyV8.JSArray, _PyV8.JSObject):
+        return toPython(obj)
 
     return obj
 
@@ -1145,6 +1700,27 @@ class TestWrapper(unittest.TestCase):
             self.assertEqual('object', typeof('var_myunicode'))
             self.assertEqual('object', typeof('var_mytime'))
 
+    def testLargeInteger(self):
+        with JSContext() as ctxt:
+            snowflake = 1234567890123456789 >> 8
+
+            ctxt.locals.id = snowflake
+
+            self.assertEqual(snowflake, ctxt.eval("id"))
+            self.assertEqual(str(snowflake), ctxt.eval("String(id)"))
+            self.assertEqual(snowflake + 1, ctxt.eval("id + 1"))
+
+            self.assertEqual(4294967295, ctxt.eval("0xffffffff"))
+            self.assertEqual(-2 ** 40, ctxt.eval("-Math.pow(2, 40)"))
+
+            ctxt.locals.big = 2 ** 32
+
+            self.assertEqual("4294967296", ctxt.eval("String(big)"))
+
+            self.assertEqual(float, type(ctxt.eval("1.5")))
+            self.assertEqual(float, type(ctxt.eval("Math.pow(2, 60)")))
+            self.assertEqual(float, type(ctxt.eval("-0")))
+
     def testJavascriptWrapper(self):
         with JSContext() as ctxt:
             self.assertEqual(type(None), type(ctxt.eval("null")))
@@ -1182,72 +1758,284 @@ class TestWrapper(unittest.TestCase):
             self.assertEqual('[object Function]', protoof(self.testPythonWrapper))
             self.assertEqual('[object Function]', protoof(int))
 
-    def testFunction(self):
+    def testTreeConversion(self):
         with JSContext() as ctxt:
-            func = ctxt.eval("""
-                (function ()
-                {
-                    function a()
-                    {
-                        return "abc";
-                    }
+            obj = ctxt.eval("""
+                var shared = {name: 'shared'};
+                var tree = {a: 1, b: [1, 2.5, 'str', null, true], c: {d: shared, e: shared}};
+                tree.self = tree;
+                tree
+            """)
 
-                    return a();
-                })
-                """)
+            tree = toPython(obj)
 
-            self.assertEqual("abc", str(func()))
-            self.assertTrue(func != None)
-            self.assertFalse(func == None)
+            self.assertEqual(1, tree['a'])
+            self.assertEqual([1, 2.5, 'str', None, True], tree['b'])
+            self.assertEqual({'name': 'shared'}, tree['c']['d'])
+            self.assertTrue(tree['c']['d'] is tree['c']['e'])
+            self.assertTrue(tree['self'] is tree)
 
-            func = ctxt.eval("(function test() {})")
+            self.assertRaises(ValueError, toPython, obj, cycles=False)
 
-            self.assertEqual("test", func.name)
-            self.assertEqual("", func.resname)
-            self.assertEqual(0, func.linenum)
-            self.assertEqual(14, func.colnum)
-            self.assertEqual(0, func.lineoff)
-            self.assertEqual(0, func.coloff)
+            self.assertTrue(isinstance(toPython(obj, depth=1)['c'], JSObject))
 
-            #TODO fix me, why the setter doesn't work?
-            # func.name = "hello"
-            # it seems __setattr__ was called instead of CJavascriptFunction::SetName
+            self.assertEqual({'name': 'shared'}, convert(ctxt.eval("shared")))
 
-            func.setName("hello")
+            # a throwing getter or Proxy trap raises the Javascript error
+            self.assertRaises(JSError, toPython, ctxt.eval("({ get bad() { throw Error('bad'); } })"))
+            self.assertRaises(JSError, toPython, ctxt.eval("[1, new Proxy({}, { ownKeys: function () { throw Error('bad'); } })]"))
 
-            self.assertEqual("hello", func.name)
+            js = fromPython({'a': [1, 2, {'b': 'c'}], 'd': (True, None)})
 
-    def testCall(self):
-        class Hello(object):
-            def __call__(self, name):
-                return "hello " + name
+            self.assertEqual('c', ctxt.eval("(function (o) { return o.a[2].b; })")(js))
+            self.assertEqual(2, ctxt.eval("(function (o) { return o.d.length; })")(js))
+            self.assertEqual({'a': [1, 2, {'b': 'c'}], 'd': [True, None]}, toPython(js))
 
-        class Global(JSClass):
-            hello = Hello()
+            # the Javascript properties with the same names are not shadowed
+            obj = ctxt.eval("({ toPython: 1, fromPython: 2, toJSON: 3 })")
 
-        with JSContext(Global()) as ctxt:
-            self.assertEqual("hello flier", ctxt.eval("hello('flier')"))
+            self.assertEqual([1, 2, 3], [obj.toPython, obj.fromPython, obj.toJSON])
 
-    def testJSFunction(self):
+    def testJSON(self):
         with JSContext() as ctxt:
-            hello = ctxt.eval("(function (name) { return 'hello ' + name; })")
+            obj = ctxt.parseJSON(b'{"name": "\xe4\xb8\xad\xe6\x96\x87", "items": [1, 2.5, null, true]}')
 
-            self.assertTrue(isinstance(hello, _PyV8.JSFunction))
-            self.assertEqual("hello flier", hello('flier'))
-            self.assertEqual("hello flier", hello.invoke(['flier']))
+            self.assertTrue(isinstance(obj, JSObject))
+            self.assertEqual(u"\u4e2d\u6587", toUnicodeString(obj.name))
+            self.assertEqual(4, len(obj.items))
 
-            obj = ctxt.eval("({ 'name': 'flier', 'hello': function (name) { return 'hello ' + name + ' from ' + this.name; }})")
-            hello = obj.hello
-            self.assertTrue(isinstance(hello, JSFunction))
-            self.assertEqual("hello flier from flier", hello('flier'))
+            self.assertEqual(3, ctxt.parseJSON(u'{"a": 3}').a)
+            self.assertEqual(1, ctxt.parseJSON(bytearray(b'1')))
 
-            tester = ctxt.eval("({ 'name': 'tester' })")
-            self.assertEqual("hello flier from tester", hello.apply(tester, ['flier']))
-            self.assertEqual("hello flier from json", hello.apply({ 'name': 'json' }, ['flier']))
+            self.assertRaises(JSError, ctxt.parseJSON, b'{invalid}')
 
-    def testConstructor(self):
-        with JSContext() as ctx:
-            ctx.eval("""
+            json = toJSON(obj)
+
+            self.assertTrue(isinstance(json, bytes))
+            self.assertEqual(b'{"name":"\xe4\xb8\xad\xe6\x96\x87","items":[1,2.5,null,true]}', json)
+
+    def testBuffer(self):
+        with JSContext() as ctxt:
+            data = bytearray(b"hello")
+
+            fill = ctxt.eval("(function (buf) { var view = new Uint8Array(buf); view[0] = 72; return buf.byteLength; })")
+
+            self.assertEqual(5, fill(data))
+            self.assertEqual(bytearray(b"Hello"), data)
+
+            buf = ctxt.eval("var buf = new ArrayBuffer(4); new Uint8Array(buf).set([1, 2, 3, 4]); buf")
+
+            self.assertTrue(isinstance(buf, memoryview))
+            self.assertEqual(b"\x01\x02\x03\x04", buf.tobytes())
+
+            buf[0] = 9
+
+            self.assertEqual(9, ctxt.eval("new Uint8Array(buf)[0]"))
+
+            view = ctxt.eval("new Float64Array([1.5, 2.5])")
+
+            self.assertEqual('d', view.format)
+            self.assertEqual([1.5, 2.5], view.tolist())
+
+            self.assertEqual(4, ctxt.eval("(function (buf) { return buf.byteLength; })")(memoryview(b"abcd")))
+
+        # the contents are read again for every export, and refused once the isolate is gone
+        if is_py3k:
+            with JSIsolate():
+                with JSContext() as ctxt:
+                    buf = ctxt.eval("new Uint8Array([1, 2, 3])")
+
+                    self.assertEqual(b"\x01\x02\x03", memoryview(buf.obj).tobytes())
+
+                    exporter = buf.obj
+
+                    buf.release()
+
+                del ctxt
+
+            self.assertRaises(BufferError, memoryview, exporter)
+
+            del exporter
+
+    def testTypeTemplate(self):
+        class Point(object):
+            __slots__ = ('x', 'y')
+
+            def __init__(self, x, y):
+                self.x = x
+                self.y = y
+
+            def length(self):
+                return (self.x ** 2 + self.y ** 2) ** 0.5
+
+            @property
+            def desc(self):
+                return "(%d, %d)" % (self.x, self.y)
+
+        class Shape(object):
+            kind = 'shape'
+
+        with JSContext() as ctxt:
+            p = Point(2, 4)
+
+            move = ctxt.eval("(function (p) { p.x = p.x + 1; return [p.x, p.y, p.length(), p.desc]; })")
+
+            self.assertEqual([3, 4, 5.0, "(3, 4)"], list(move(p)))
+            self.assertEqual(3, p.x)
+
+            self.assertEqual(1, ctxt.eval("(function (p) { return new p.constructor(1, 2).x; })")(p))
+
+            kind = ctxt.eval("(function (o) { return o.kind; })")
+
+            s = Shape()
+
+            self.assertEqual('shape', kind(s))
+
+            s.kind = 'circle'
+
+            self.assertEqual('circle', kind(s))
+
+            ctxt.eval("(function (o) { o.kind = 'square'; o.size = 5; })")(s)
+
+            self.assertEqual('square', s.kind)
+            self.assertEqual(5, s.size)
+
+            Shape.color = 'red'
+
+            self.assertEqual('red', ctxt.eval("(function (o) { return o.color; })")(Shape()))
+
+            # a type modified too often falls back to the generic template
+            for i in range(10):
+                setattr(Shape, 'attr%d' % i, i)
+
+                self.assertEqual(i, ctxt.eval("(function (o) { return o.attr%d; })" % i)(Shape()))
+
+            # the types are only weakly referenced by the templates
+            import gc, weakref
+
+            Temp = type('Temp', (object,), {'value': 1})
+            ref = weakref.ref(Temp)
+
+            self.assertEqual(1, ctxt.eval("(function (o) { return o.value; })")(Temp()))
+
+            del Temp
+
+            JSEngine.collect()
+            gc.collect()
+
+            self.assertTrue(ref() is None)
+
+            # the instance attributes and __getattr__ shadow the names of Object.prototype
+            class Named(object):
+                def __getattr__(self, name):
+                    if name == 'valueOf':
+                        return lambda: 42
+
+                    raise AttributeError(name)
+
+            class Plain(object):
+                pass
+
+            s = Plain()
+            s.toString = lambda: 'a shape'
+
+            self.assertEqual('a shape', ctxt.eval("(function (o) { return o.toString(); })")(s))
+            self.assertEqual(42, ctxt.eval("(function (o) { return o.valueOf(); })")(Named()))
+
+    def testFunction(self):
+        with JSContext() as ctxt:
+            func = ctxt.eval("""
+                (function ()
+                {
+                    function a()
+                    {
+                        return "abc";
+                    }
+
+                    return a();
+                })
+                """)
+
+            self.assertEqual("abc", str(func()))
+            self.assertTrue(func != None)
+            self.assertFalse(func == None)
+
+            func = ctxt.eval("(function test() {})")
+
+            self.assertEqual("test", func.name)
+            self.assertEqual("", func.resname)
+            self.assertEqual(0, func.linenum)
+            self.assertEqual(14, func.colnum)
+            self.assertEqual(0, func.lineoff)
+            self.assertEqual(0, func.coloff)
+
+            #TODO fix me, why the setter doesn't work?
+            # func.name = "hello"
+            # it seems __setattr__ was called instead of CJavascriptFunction::SetName
+
+            func.setName("hello")
+
+            self.assertEqual("hello", func.name)
+
+    def testCall(self):
+        class Hello(object):
+            def __call__(self, name):
+                return "hello " + name
+
+        class Global(JSClass):
+            hello = Hello()
+
+        with JSContext(Global()) as ctxt:
+            self.assertEqual("hello flier", ctxt.eval("hello('flier')"))
+
+    def testCallManyArguments(self):
+        class Global(JSClass):
+            def total(self, *args):
+                return sum(args)
+
+        with JSContext(Global()) as ctxt:
+            self.assertEqual(0, ctxt.eval("total()"))
+            self.assertEqual(78, ctxt.eval("total(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12)"))
+            self.assertEqual(5050, ctxt.eval("total.apply(null, Array.from({length: 100}, (v, i) => i + 1))"))
+
+    def testJSFunction(self):
+        with JSContext() as ctxt:
+            hello = ctxt.eval("(function (name) { return 'hello ' + name; })")
+
+            self.assertTrue(isinstance(hello, _PyV8.JSFunction))
+            self.assertEqual("hello flier", hello('flier'))
+            self.assertEqual("hello flier", hello.invoke(['flier']))
+
+            obj = ctxt.eval("({ 'name': 'flier', 'hello': function (name) { return 'hello ' + name + ' from ' + this.name; }})")
+            hello = obj.hello
+            self.assertTrue(isinstance(hello, JSFunction))
+            self.assertEqual("hello flier from flier", hello('flier'))
+
+            tester = ctxt.eval("({ 'name': 'tester' })")
+            self.assertEqual("hello flier from tester", hello.apply(tester, ['flier']))
+            self.assertEqual("hello flier from json", hello.apply({ 'name': 'json' }, ['flier']))
+
+    def testBatchCall(self):
+        with JSContext() as ctxt:
+            add = ctxt.eval("(function (a, b) { if (a < 0) throw new RangeError('negative'); return a + (b || 0); })")
+
+            self.assertEqual([1, 2, 3], add.map([1, 2, 3]))
+            self.assertEqual([3, 7, 11], add.map(((i, i+1) for i in range(1, 6, 2)), chunk=2))
+            self.assertEqual([3, 7], add.callMany([[1, 2], [3, 4]]))
+            self.assertEqual([3, 7], add.callMany(((i, i + 1) for i in (1, 3))))
+            self.assertEqual([], add.map([]))
+
+            self.assertRaises(IndexError, add.map, [1, -1, 2])
+
+            results = add.map(range(-1, 3), chunk=3, collect_errors=True)
+
+            self.assertEqual(4, len(results))
+            self.assertTrue(isinstance(results[0], IndexError))
+            self.assertEqual([0, 1, 2], results[1:])
+
+    def testConstructor(self):
+        with JSContext() as ctx:
+            ctx.eval("""
                 var Test = function() {
                     this.trySomething();
                 };
@@ -1311,6 +2099,43 @@ class TestWrapper(unittest.TestCase):
                                      '    at hello (test:14:35)\n' +
                                      '    at test:17:25', e.stackTrace)
 
+    def testLazyError(self):
+        with JSContext() as ctxt:
+            check = ctxt.eval("(function (n) { if (n % 2) throw Error('odd ' + n); return n; })")
+
+            errors = []
+
+            for i in range(100):
+                try:
+                    check(i)
+                except JSError as e:
+                    errors.append(e)
+
+            self.assertEqual(50, len(errors))
+
+            # the copies share the caught exception, which is only formatted when it's read
+            self.assertEqual("odd 99", errors[-1].message)
+            self.assertTrue(str(errors[-1]).startswith('JSError: Error: odd 99 ( '))
+            self.assertEqual(str(errors[-1]), str(errors[-1]))
+
+        # an error may outlive its isolate, and still be read (and dropped) safely
+        isolate = JSIsolate()
+
+        with isolate:
+            with JSContext() as ctxt:
+                try:
+                    ctxt.eval("throw Error('gone')")
+                except JSError as e:
+                    err = e
+
+            del ctxt
+
+        del isolate
+
+        self.assertTrue(str(err).startswith('JSError: '))
+
+        del err
+
     def testParseStack(self):
         self.assertEqual([
             ('Error', 'unknown source', None, None),
@@ -1632,6 +2457,70 @@ class TestWrapper(unittest.TestCase):
 
             self.assertEqual(2, func(u"测试"))
 
+    def testLargeString(self):
+        with JSContext() as ctxt:
+            func = ctxt.eval("(function (s) { return [s.length, s.charCodeAt(s.length - 1), s + ''] })")
+
+            # the large strings are shared with V8 as external strings
+            for text in [u"<p>html</p>" * 10000, u"<p>caf\xe9</p>" * 10000,
+                         u"<p>\u4e2d\u6587</p>" * 10000, u"<p>\U0001f600</p>" * 10000, u"caf\xe9 \u4e2d"]:
+                result = func(text)
+
+                self.assertEqual(len(text.encode('utf-16-le')) // 2, result[0])
+                self.assertEqual(ord(text[-1]), result[1])
+                self.assertEqual(text, toUnicodeString(result[2]))
+
+            self.assertEqual(u"<p>html</p>" * 10000, toUnicodeString(func(toNativeString(u"<p>html</p>" * 10000))[2]))
+
+    def testPromise(self):
+        isolate = JSIsolate.current
+
+        self.assertEqual(JSMicrotaskPolicy.auto, isolate.microtaskPolicy)
+
+        with JSContext() as ctxt:
+            resolved = []
+
+            isolate.microtaskPolicy = JSMicrotaskPolicy.explicit
+
+            try:
+                promise = ctxt.eval("var resolve; new Promise(function (r) { resolve = r; })")
+
+                self.assertTrue(isinstance(promise, JSPromise))
+                self.assertEqual(JSPromiseState.pending, promise.state)
+                self.assertRaises(RuntimeError, getattr, promise, 'result')
+
+                derived = promise.then(lambda value: resolved.append(value) or value * 2)
+
+                ctxt.locals.resolve(21)
+
+                self.assertEqual(JSPromiseState.fulfilled, promise.state)
+                self.assertEqual(21, promise.result)
+
+                # the reactions are batched until the checkpoint
+                self.assertEqual([], resolved)
+                self.assertEqual(JSPromiseState.pending, derived.state)
+
+                isolate.runMicrotasks()
+
+                self.assertEqual([21], resolved)
+                self.assertEqual(42, derived.result)
+
+                rejected = ctxt.eval("Promise.reject(new Error('fail'))")
+
+                self.assertEqual(JSPromiseState.rejected, rejected.state)
+                self.assertEqual("fail", rejected.result.message)
+
+                # the reactions run when the outermost call from Python returns
+                isolate.microtaskPolicy = JSMicrotaskPolicy.scoped
+
+                del resolved[:]
+
+                rejected.then(None, lambda reason: resolved.append(reason.message))
+
+                self.assertEqual(["fail"], resolved)
+            finally:
+                isolate.microtaskPolicy = JSMicrotaskPolicy.auto
+
     def testClassicStyleObject(self):
         class FileSystemWarpper:
             @property
@@ -1773,6 +2662,14 @@ class TestWrapper(unittest.TestCase):
             self.assertTrue(ctxt.eval("b == b"))
             self.assertTrue(ctxt.eval("o == o"))
 
+            # grow the identity table beyond its initial capacity
+            objs = [object() for i in range(1000)]
+
+            ctxt.locals.objs = objs
+            ctxt.eval("var first = []; for (var i = 0; i < objs.length; i++) first.push(objs[i]);")
+
+            self.assertTrue(ctxt.eval("first.every(function (o, i) { return o === objs[i]; })"))
+
     def testNamedSetter(self):
         class Obj(JSClass):
             @property
@@ -1800,6 +2697,51 @@ class TestWrapper(unittest.TestCase):
             self.assertEqual(10, ctxt.eval("obj.p"))
             self.assertEqual(10, ctxt.locals.d['y'])
 
+    def testPropertyNames(self):
+        class Global(JSClass):
+            def __init__(self):
+                self.d = {}
+
+        with JSContext(Global()) as ctxt:
+            obj = ctxt.eval("({ name: 1 })")
+
+            # the interned names hit the cache, the computed ones take the slow path
+            for i in range(3):
+                self.assertEqual(1, obj.name)
+                self.assertEqual(1, obj["".join(["na", "me"])])
+
+            obj.name = 3
+            obj["".join(["ot", "her"])] = 4
+
+            self.assertEqual(3, obj.name)
+            self.assertEqual(4, obj.other)
+
+            del obj.other
+
+            self.assertFalse(hasattr(obj, "other"))
+
+            self.assertRaises(TypeError, obj.__getattr__, 1)
+
+            # the names from Javascript are interned, so Python sees the same object
+            ctxt.eval("for (var i = 0; i < 3; i++) { d['k' + i] = i; d.key = i; }")
+
+            self.assertEqual({'k0': 0, 'k1': 1, 'k2': 2, 'key': 2}, ctxt.locals.d)
+            self.assertEqual(2, ctxt.eval("d.k2"))
+            self.assertTrue(ctxt.eval("'key' in d"))
+            self.assertTrue(ctxt.eval("delete d.key"))
+            self.assertEqual(['k0', 'k1', 'k2'], sorted(ctxt.locals.d.keys()))
+
+            # a pass over more computed keys than the cache holds evicts them, not the hot names
+            ctxt.eval("for (var i = 0; i < 3000; i++) { d['n' + i] = i; d.key = d.k2; }")
+
+            self.assertEqual(3000 + 4, len(ctxt.locals.d))
+            self.assertEqual(2999, ctxt.eval("d.n2999"))
+            self.assertEqual(2, ctxt.eval("d.key"))
+
+            for i in range(3):
+                self.assertEqual(1, obj.name)
+                self.assertEqual(1, obj["".join(["na", "me"])])
+
     def testWatch(self):
         class Obj(JSClass):
             def __init__(self):
@@ -1927,6 +2869,157 @@ class TestMultiThread(unittest.TestCase):
 
         del locker
 
+        # the context and its objects are dropped outside of any lock once JSLocker is active
+        with JSContext() as ctxt:
+            obj = ctxt.eval("({ name: 1 })")
+            func = ctxt.eval("(function () { return 1; })")
+
+            try:
+                ctxt.eval("throw Error('dropped')")
+            except JSError as e:
+                err = e
+
+        del obj, func, err, ctxt
+
+        with JSContext() as ctxt:
+            self.assertEqual(2, ctxt.eval("1 + 1"))
+
+    def testLockerScheduler(self):
+        import time, threading
+
+        isolate = JSIsolate()
+        result = []
+
+        def lock(**kwds):
+            locker = JSLocker(isolate, **kwds)
+
+            try:
+                locker.enter()
+            except JSTimeoutError:
+                result.append('timeout')
+            else:
+                result.append(kwds.get('priority', 0))
+
+                locker.leave()
+
+        def waiting(count):
+            while isolate.lockStatistics()['waiting'] < count:
+                time.sleep(0.01)
+
+        owner = JSLocker(isolate)
+        owner.enter()
+
+        # the owner may lock it again
+        lock()
+        self.assertEqual([0], result)
+        del result[:]
+
+        threads = [threading.Thread(target=lock), threading.Thread(target=lock, kwargs={'priority': 1})]
+
+        for i, t in enumerate(threads):
+            t.start()
+            waiting(i + 1)
+
+        t = threading.Thread(target=lock, kwargs={'timeout': 0.1})
+        t.start()
+        t.join()
+
+        self.assertEqual(['timeout'], result)
+
+        # the higher priority lane is served first
+        owner.leave()
+
+        for t in threads:
+            t.join()
+
+        self.assertEqual(['timeout', 1, 0], result)
+
+        stats = isolate.lockStatistics()
+
+        self.assertFalse(stats['locked'])
+        self.assertEqual(0, stats['waiting'])
+        self.assertEqual(1, stats['timeouts'])
+        self.assertEqual(3, stats['contended'])
+        self.assertEqual(1, stats['lanes'][1]['acquisitions'])
+        self.assertTrue(stats['max_wait'] > 0)
+
+        self.assertEqual(3, JSUnlocker.blocking(lambda a, b: a + b)(1, 2))
+
+        # a locker dropped while entered hands the isolate to the other threads
+        del result[:]
+
+        owner = JSLocker(isolate)
+        owner.enter()
+
+        del owner
+
+        t = threading.Thread(target=lock, kwargs={'timeout': 1})
+        t.start()
+        t.join()
+
+        self.assertEqual([0], result)
+
+    def testGILStatistics(self):
+        class Global(JSClass):
+            def hello(self):
+                return 1
+
+        with JSContext(Global()) as ctxt:
+            ctxt.resetGILStatistics()
+
+            self.assertFalse(ctxt.batchCallbacks)
+            self.assertEqual(100, ctxt.eval("var n = 0; for (var i = 0; i < 100; i++) n += hello(); n"))
+
+            stats = ctxt.gilStatistics
+
+            self.assertTrue(stats['acquisitions'] >= 100)
+            self.assertEqual(0, stats['reused'])
+            self.assertTrue(stats['wait'] >= 0)
+            self.assertTrue(stats['hold'] > 0)
+
+            # the consecutive callbacks reuse the GIL kept by the previous one
+            ctxt.resetGILStatistics()
+            ctxt.batchCallbacks = True
+
+            self.assertEqual(100, ctxt.eval("var n = 0; for (var i = 0; i < 100; i++) n += hello(); n"))
+
+            stats = ctxt.gilStatistics
+
+            self.assertTrue(stats['acquisitions'] + stats['reused'] >= 100)
+            self.assertTrue(stats['reused'] > 0)
+
+    def testGILBatchSlice(self):
+        import time
+
+        started = threading.Event()
+        ran = []
+
+        class Global(JSClass):
+            def hello(self):
+                started.set()
+
+                return 1
+
+        def run():
+            started.wait()
+
+            ran.append(time.time())
+
+        t = threading.Thread(target=run)
+        t.start()
+
+        with JSContext(Global()) as ctxt:
+            ctxt.batchCallbacks = True
+
+            # the GIL kept by the callback is released while the loop runs pure Javascript
+            ctxt.eval("hello(); var end = Date.now() + 500; while (Date.now() < end) {}")
+
+            finished = time.time()
+
+        t.join()
+
+        self.assertTrue(ran[0] < finished - 0.25)
+
     def testMultiPythonThread(self):
         import time, threading
 
@@ -1998,6 +3091,104 @@ class TestMultiThread(unittest.TestCase):
 
         self.assertEqual(20, len(g.result))
 
+    def testPooledIsolates(self):
+        class Global:
+            base = 100
+
+        with JSIsolatePool(2, Global(), warmup="function add(a, b) { return base + a + b; }") as pool:
+            self.assertEqual(2, len(pool))
+
+            self.assertEqual(3, pool.submit("1+2").result())
+            self.assertEqual(103, pool.submit("add", 1, 2).result())
+            self.assertEqual([1, 2, 3], pool.submit("[1, 2, 3]").result())
+            self.assertEqual({'a': 1}, pool.submit("({a: 1})").result())
+
+            self.assertEqual([101, 103, 105], pool.map("add", [0, 1, 2], [1, 2, 3]))
+
+            future = pool.submit("throw Error('fail')")
+
+            self.assertTrue(isinstance(future.exception(), JSError))
+            self.assertRaises(JSError, future.result)
+
+            # the functions don't keep the handles into the worker isolate
+            source = pool.submit("(function (a) { return a; })").result()
+
+            self.assertTrue(isinstance(source, str))
+            self.assertTrue(source.startswith("function"))
+
+            future = pool.submit("(function () { var end = Date.now() + 500; while (Date.now() < end) {} })()")
+
+            self.assertRaises(FutureTimeoutError, future.result, 0.01)
+            self.assertEqual(None, future.result())
+
+            future = pool.submit("throw Error('fail')")
+
+        self.assertRaises(RuntimeError, pool.submit, "1+2")
+
+        # the error is still readable after its isolate was disposed
+        self.assertEqual("Error", future.exception().name)
+        self.assertEqual("fail", future.exception().message)
+        self.assertTrue(str(future.exception()).startswith("JSError: Error: fail"))
+
+    def testAsync(self):
+        if not is_py3k:
+            return
+
+        import asyncio
+
+        loop = asyncio.new_event_loop()
+
+        ctxt = JSContext()
+
+        with ctxt:
+            ctxt.eval("function add(a, b) { return a + b; }")
+
+        try:
+            self.assertEqual(3, loop.run_until_complete(ctxt.eval_async("1 + 2", loop=loop)))
+            self.assertEqual([1, 2], loop.run_until_complete(ctxt.eval_async("[1, 2]", converter=convert, loop=loop)))
+            self.assertRaises(JSError, loop.run_until_complete, ctxt.eval_async("throw Error('fail')", loop=loop))
+
+            # the settled value of a promise
+            self.assertEqual(4, loop.run_until_complete(ctxt.eval_async("Promise.resolve(4)", loop=loop)))
+            self.assertRaises(JSError, loop.run_until_complete, ctxt.eval_async("Promise.reject(new Error('fail'))", loop=loop))
+
+            # the errors of the converter settle the future too
+            def fail(value):
+                raise ValueError(value)
+
+            self.assertRaises(ValueError, loop.run_until_complete, ctxt.eval_async("7", converter=fail, loop=loop))
+            self.assertRaises(ValueError, loop.run_until_complete, ctxt.eval_async("Promise.resolve(8)", converter=fail, loop=loop))
+
+            try:
+                loop.run_until_complete(ctxt.eval_async("Promise.reject(new TypeError('rejected'))", loop=loop))
+            except JSError as e:
+                self.assertEqual("TypeError", e.name)
+                self.assertEqual("rejected", e.message)
+            else:
+                self.fail("the rejection isn't raised")
+
+            func = loop.run_until_complete(ctxt.eval_async("add", loop=loop))
+
+            self.assertEqual(5, loop.run_until_complete(func.call_async(2, 3, loop=loop)))
+
+            obj = loop.run_until_complete(ctxt.eval_async("({ promise: Promise.resolve(6) })", loop=loop))
+
+            with ctxt:
+                promise = obj.promise
+
+                self.assertTrue(isinstance(promise, JSPromise))
+
+                del obj
+
+            self.assertEqual(6, loop.run_until_complete(promise))
+
+            with ctxt:
+                del func, promise
+        finally:
+            JSIsolateThread.stop()
+
+            loop.close()
+
 
 class TestEngine(unittest.TestCase):
     def setUp(self):
@@ -2025,6 +3216,91 @@ class TestEngine(unittest.TestCase):
 
                 self.assertRaises(SyntaxError, engine.compile, "1+")
 
+    def testCompileCache(self):
+        with JSContext() as ctxt:
+            with JSEngine() as engine:
+                JSEngine.clearCompileCache()
+
+                hits, misses = JSEngine.compileCacheHits, JSEngine.compileCacheMisses
+
+                self.assertEqual(3, int(engine.compile("1+2", "cached.js").run()))
+                self.assertEqual(3, int(engine.compile("1+2", "cached.js").run()))
+                self.assertEqual(3, ctxt.eval("1+2", "cached.js"))
+
+                self.assertEqual(hits + 2, JSEngine.compileCacheHits)
+                self.assertEqual(misses + 1, JSEngine.compileCacheMisses)
+
+                engine.compile("1+2", "other.js")
+
+                self.assertEqual(misses + 2, JSEngine.compileCacheMisses)
+                self.assertEqual(2, JSEngine.compileCacheSize)
+
+                capacity = JSEngine.compileCacheCapacity
+                evictions = JSEngine.compileCacheEvictions
+
+                JSEngine.compileCacheCapacity = 1
+
+                self.assertEqual(1, JSEngine.compileCacheSize)
+                self.assertEqual(evictions + 1, JSEngine.compileCacheEvictions)
+
+                JSEngine.compileCacheCapacity = capacity
+
+    def testCodeCache(self):
+        import shutil
+        import tempfile
+
+        src = "function fib(n) { return n < 2 ? n : fib(n-1) + fib(n-2); }; fib(10)"
+
+        with JSContext() as ctxt:
+            with JSEngine() as engine:
+                JSEngine.clearCompileCache()
+
+                s = engine.compile(src, "fib.js")
+
+                data = s.codeCache
+
+                self.assertTrue(data)
+                self.assertFalse(s.codeCacheRejected)
+
+                JSEngine.clearCompileCache()
+
+                s = engine.compile(src, "fib.js", cached_data=data)
+
+                self.assertFalse(s.codeCacheRejected)
+                self.assertEqual(55, int(s.run()))
+
+                JSEngine.clearCompileCache()
+
+                s = engine.compile(src, "fib.js", cached_data=b"invalid code cache")
+
+                self.assertTrue(s.codeCacheRejected)
+                self.assertEqual(None, s.codeCache)
+
+                cache_dir = tempfile.mkdtemp()
+
+                try:
+                    JSEngine.codeCacheDir = cache_dir
+
+                    self.assertEqual(cache_dir, JSEngine.codeCacheDir)
+
+                    JSEngine.clearCompileCache()
+
+                    engine.compile(src, "fib.js")
+
+                    self.assertEqual(1, len([f for f in os.listdir(cache_dir) if f.endswith(".jsc")]))
+
+                    JSEngine.clearCompileCache()
+
+                    s = engine.compile(src, "fib.js")
+
+                    self.assertTrue(s.codeCache)
+                    self.assertFalse(s.codeCacheRejected)
+                    self.assertEqual(55, int(s.run()))
+                finally:
+                    JSEngine.codeCacheDir = ""
+
+                    shutil.rmtree(cache_dir)
+
     def testPrecompile(self):
         with JSContext() as ctxt:
             with JSEngine() as engine:
@@ -2168,28 +3444,25 @@ class TestEngine(unittest.TestCase):
         with JSContext(extensions=['hello/python']) as ctxt:
             self.assertEqual("hello flier from python", ctxt.eval("hello('flier')"))
 
-    def _testSerialize(self):
-        data = None
-
-        self.assertFalse(JSContext.entered)
-
-        with JSContext() as ctxt:
-            self.assertTrue(JSContext.entered)
-
-            #ctxt.eval("function hello(name) { return 'hello ' + name; }")
-
-            data = JSEngine.serialize()
+    def testSnapshot(self):
+        snapshot = JSEngine.createSnapshot("""
+            function hello(name) { return 'hello ' + name; }
 
-        self.assertTrue(data)
-        self.assertTrue(len(data) > 0)
+            var answer = 42;
+        """)
 
-        self.assertFalse(JSContext.entered)
+        self.assertTrue(snapshot)
 
-        #JSEngine.deserialize()
+        with JSIsolate(snapshot=snapshot):
+            with JSContext() as ctxt:
+                self.assertEqual("hello flier", ctxt.eval("hello('flier')"))
+                self.assertEqual(42, ctxt.eval("answer"))
 
-        self.assertTrue(JSContext.entered)
+        with JSIsolate():
+            with JSContext() as ctxt:
+                self.assertEqual("undefined", ctxt.eval("typeof hello"))
 
-        self.assertEqual('hello flier', JSContext.current.eval("hello('flier');"))
+        self.assertRaises(RuntimeError, JSEngine.createSnapshot, "throw Error('fail');")
 
     def testEval(self):
         with JSContext() as ctxt:
@@ -2291,6 +3564,136 @@ class TestEngine(unittest.TestCase):
 
                 JSEngine.collect()
 
+    def testCpuProfiler(self):
+        with JSContext() as ctxt:
+            JSEngine().compile("""
+                function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+                function run() { var s = 0; for (var i = 0; i < 10; i++) s += fib(25); return s; }
+                """, "fib.js").run()
+
+            with JSProfiler(interval=100) as profiler:
+                ctxt.eval("run()")
+
+            profile = profiler.profile
+
+            self.assertTrue(profile.duration > 0)
+            self.assertEqual('(root)', profile.tree['function'])
+
+            fib = [entry for entry in profile.flat() if entry.function == 'fib']
+
+            self.assertTrue(fib)
+            self.assertEqual('fib.js', fib[0].script)
+            self.assertEqual(2, fib[0].line)
+            self.assertTrue(fib[0].total_time >= fib[0].self_time)
+
+            data = json.loads(profile.json())
+
+            self.assertTrue(set(['nodes', 'startTime', 'endTime', 'samples', 'timeDeltas']) <= set(data.keys()))
+            self.assertEqual(len(data['samples']), len(data['timeDeltas']))
+
+            import tempfile
+
+            fd, path = tempfile.mkstemp(suffix='.cpuprofile')
+            os.close(fd)
+
+            try:
+                profile.save(path)
+
+                with open(path) as f:
+                    self.assertEqual(data, json.load(f))
+            finally:
+                os.remove(path)
+
+    def testHeapProfiler(self):
+        class PinnedByJavascript(object):
+            pass
+
+        with JSContext() as ctxt:
+            ctxt.locals.pinned = PinnedByJavascript()
+
+            profiler = JSHeapProfiler()
+
+            import io
+
+            output = io.BytesIO()
+
+            profiler.takeSnapshot(output)
+
+            snapshot = json.loads(output.getvalue().decode('utf-8'))
+
+            self.assertTrue('nodes' in snapshot)
+            self.assertTrue('PinnedByJavascript' in snapshot['strings'])
+
+            profiler.startSampling(interval=1024)
+
+            self.assertTrue(profiler.sampling)
+
+            ctxt.eval("var junk = []; for (var i = 0; i < 10000; i++) junk.push({ i: i });")
+
+            profile = profiler.stopSampling()
+
+            self.assertFalse(profiler.sampling)
+            self.assertEqual('(root)', profile['name'])
+            self.assertTrue(profile['children'])
+
+    def testHeapStatistics(self):
+        with JSIsolate() as isolate:
+            with JSContext() as ctxt:
+                ctxt.eval("var a = []; for (var i = 0; i < 100000; i++) a.push({ i: i });")
+
+                JSEngine.collect()
+
+                stats = isolate.heapStatistics()
+
+                self.assertTrue(stats['used_heap_size'] > 0)
+                self.assertTrue(stats['heap_size_limit'] >= stats['total_heap_size'])
+
+                spaces = isolate.heapSpaceStatistics()
+
+                self.assertTrue('new_space' in [space['space_name'] for space in spaces])
+
+                gc = isolate.gcStatistics()
+
+                self.assertEqual(set(['scavenge', 'mark_sweep_compact', 'incremental_marking', 'process_weak_callbacks']), set(gc.keys()))
+                self.assertTrue(gc['mark_sweep_compact']['count'] > 0)
+                self.assertEqual(gc['mark_sweep_compact']['count'], sum(count for bound, count in gc['mark_sweep_compact']['histogram']))
+
+                isolate.resetGCStatistics()
+
+                self.assertEqual(0, isolate.gcStatistics()['scavenge']['count'])
+
+    def testHeapLimit(self):
+        with JSIsolate(max_old_space=32, max_young_space=4):
+            with JSContext() as ctxt:
+                self.assertRaises(MemoryError, ctxt.eval, "var a = []; while(true) a.push(new Array(1024).fill(0));")
+
+        with JSIsolate(max_old_space=32, max_young_space=4):
+            with JSContext() as ctxt:
+                fill = ctxt.eval("(function () { var a = []; while(true) a.push(new Array(1024).fill(0)); })")
+
+                self.assertRaises(MemoryError, fill)
+
+                # the termination is cancelled and the limit rearmed after any call into Javascript
+                self.assertEqual(3, ctxt.eval("1 + 2"))
+                self.assertRaises(MemoryError, fill)
+
+    def testTimeout(self):
+        with JSContext() as ctxt:
+            start = datetime.now()
+
+            self.assertRaises(JSTimeoutError, ctxt.eval, "while(true) {}", timeout=0.1)
+            self.assertTrue((datetime.now() - start).total_seconds() < 5)
+
+            self.assertRaises(JSTimeoutError, ctxt.eval, "while(true) {}", cpu_budget=0.1)
+
+            # the context is still usable after the termination
+            self.assertEqual(3, ctxt.eval("1 + 2", timeout=1))
+
+            script = JSEngine().compile("var n = 0; while(true) n++;")
+
+            self.assertRaises(JSTimeoutError, script.run, timeout=0.1)
+            self.assertTrue(ctxt.eval("n") > 0)
+
     def testStackLimit(self):
         with JSIsolate():
             JSEngine.setStackLimit(256 * 1024)
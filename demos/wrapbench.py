@@ -0,0 +1,52 @@
+#!/usr/bin/env python
+"""
+Microbenchmark of wrapping Javascript values into Python objects.
+
+Every item fetched from a Javascript array, and every object returned from
+a Javascript function, creates a new Python wrapper. Run it against two
+builds to compare the wrappers per second before and after a change:
+
+    python demos/wrapbench.py [count] [rounds]
+"""
+from __future__ import with_statement
+from __future__ import print_function
+
+import sys
+import timeit
+
+import PyV8
+
+SOURCES = [
+    ("object", "{ i: i }"),
+    ("array", "[i]"),
+    ("function", "function () { return i; }"),
+]
+
+
+def bench(ctxt, name, expr, count, rounds):
+    items = ctxt.eval("(function () { var items = []; for (var i = 0; i < %d; i++) items.push(%s); return items; })()" % (count, expr))
+    make = ctxt.eval("(function (i) { return %s; })" % expr)
+
+    def fetch():
+        for item in items:
+            pass
+
+    def call():
+        for i in range(count):
+            make(i)
+
+    for kind, func in [("fetch", fetch), ("return", call)]:
+        elapsed = min(timeit.repeat(func, number=1, repeat=rounds))
+
+        print("%-8s %-6s %12.0f wrappers/s" % (name, kind, count / elapsed))
+
+
+def main(count=100000, rounds=5):
+    with PyV8.JSContext() as ctxt:
+        for name, expr in SOURCES:
+            bench(ctxt, name, expr, count, rounds)
+
+        PyV8.JSEngine.collect()
+
+if __name__ == '__main__':
+    main(*[int(arg) for arg in sys.argv[1:3]])
@@ -103,6 +103,7 @@ if V8_USE_SNAPSHOT:
     macros += [('V8_USE_EXTERNAL_STARTUP_DATA', None)]
 
 boost_libs = [
+    'boost_chrono',
     'boost_date_time',
     'boost_filesystem',
     'boost_log',
@@ -319,7 +319,7 @@ if __name__ == '__main__':
                         stream=sys.stderr)
 
     source_files = ["Utils.cpp", "Logger.cpp", "Exception.cpp", "Isolate.cpp", "Context.cpp",
-                    "Engine.cpp", "Wrapper.cpp", "Debug.cpp", "Locker.cpp", "PyV8.cpp"]
+                    "Engine.cpp", "Wrapper.cpp", "Debug.cpp", "Locker.cpp", "Watchdog.cpp", "Profiler.cpp", "PyV8.cpp"]
 
     if V8_AST:
         source_files += ["AST.cpp", "PrettyPrinter.cpp"]
@@ -1,9 +1,6 @@
 #pragma once
 
-//
-// Enable it if you want to support serialize/deserialize the heap objects to/from a snapshot file
-//
-//#define SUPPORT_SERIALIZE 1
+#include <v8-version.h>
 
 //
 // Enable it if you want to support the javascript or python extension
@@ -27,11 +27,27 @@ void CContext::Expose(void)
       .def("eval", &CContext::Evaluate, (py::arg("source"),
                                          py::arg("name") = std::string(),
                                          py::arg("line") = -1,
-                                         py::arg("col") = -1))
+                                         py::arg("col") = -1,
+                                         py::arg("timeout") = 0.0,
+                                         py::arg("cpu_budget") = 0.0),
+           "Evaluate the source code, terminate it with JSTimeoutError "
+           "when the timeout or CPU budget (in seconds) is exhausted.")
       .def("eval", &CContext::EvaluateW, (py::arg("source"),
                                           py::arg("name") = std::string(),
                                           py::arg("line") = -1,
-                                          py::arg("col") = -1))
+                                          py::arg("col") = -1,
+                                          py::arg("timeout") = 0.0,
+                                          py::arg("cpu_budget") = 0.0))
+
+      .def("parseJSON", &CContext::ParseJSON, (py::arg("json")),
+           "Parse the JSON text (UTF-8 encoded bytes or unicode) to Javascript value in this context.")
+
+      .add_property("batchCallbacks", &CContext::IsBatchCallbacks, &CContext::SetBatchCallbacks,
+                    "Keep the GIL between the consecutive Python callbacks of a script, "
+                    "for at most a few milliseconds.")
+      .add_property("gilStatistics", &CContext::GetGILStatistics,
+                    "The GIL acquired, reused, waited and held by the Python callbacks of this context.")
+      .def("resetGILStatistics", &CContext::ResetGILStatistics)
 
       .def("enter", &CContext::Enter, "Enter this context. "
                                       "After entering a context, all code compiled and "
@@ -49,17 +65,20 @@ void CContext::Expose(void)
                                                                   py::objects::pointer_holder<CContextPtr, CContext>>>();
 }
 
-CContext::CContext(v8::Handle<v8::Context> context, v8::Isolate *isolate) : m_context(isolate, context)
+CContext::CContext(v8::Handle<v8::Context> context, v8::Isolate *isolate)
+    : m_isolate(isolate), m_context(isolate, context), m_gil(new CGILAccount())
 {
   BOOST_LOG_SEV(logger(), trace) << "context wrapped";
 }
 
-CContext::CContext(const CContext &context, v8::Isolate *isolate) : m_context(isolate, context.m_context)
+CContext::CContext(const CContext &context, v8::Isolate *isolate)
+    : m_isolate(isolate), m_context(isolate, context.m_context), m_gil(context.m_gil)
 {
   BOOST_LOG_SEV(logger(), trace) << "context copied";
 }
 
 CContext::CContext(py::object global, py::list extensions, v8::Isolate *isolate)
+    : m_isolate(isolate), m_gil(new CGILAccount())
 {
   v8::HandleScope handle_scope(isolate);
 
@@ -119,11 +138,16 @@ void CContext::Dispose(bool disposed, v8::Isolate *isolate)
   if (m_context.IsEmpty())
     return;
 
+  if (!isolate)
+    isolate = m_isolate;
+
+  CDisposeLocker locker(isolate);
+
   v8::HandleScope handle_scope(isolate);
 
   auto context = m_context.Get(isolate);
 
-  BOOST_LOG_SEV(logger(), trace) << "context " << (disposed ? "disposed" : "destroyed");
+  BOOST_LOG_SEV(logger(isolate), trace) << "context " << (disposed ? "disposed" : "destroyed");
 
   delete GetEmbedderData<logger_t>(context, EmbedderDataFields::LoggerIndex);
 
@@ -189,6 +213,8 @@ void CContext::Enter(void)
 
   Context()->Enter();
 
+  CGILAccount::Push(m_gil);
+
   BOOST_LOG_SEV(logger(), trace) << "context entered";
 }
 void CContext::Leave(void)
@@ -197,9 +223,25 @@ void CContext::Leave(void)
 
   Context()->Exit();
 
+  CGILAccount::Pop();
+
   BOOST_LOG_SEV(logger(), trace) << "context exited";
 }
 
+py::dict CContext::GetGILStatistics(void) const
+{
+  typedef std::chrono::duration<double> seconds;
+
+  py::dict result;
+
+  result["acquisitions"] = m_gil->acquisitions;
+  result["reused"] = m_gil->reused;
+  result["wait"] = std::chrono::duration_cast<seconds>(m_gil->wait).count();
+  result["hold"] = std::chrono::duration_cast<seconds>(m_gil->hold).count();
+
+  return result;
+}
+
 py::object CContext::GetEntered(v8::Isolate *isolate)
 {
   v8::HandleScope handle_scope(isolate);
@@ -229,7 +271,8 @@ py::object CContext::GetCalling(v8::Isolate *isolate)
 
 py::object CContext::Evaluate(const std::string &src,
                               const std::string name,
-                              int line, int col)
+                              int line, int col,
+                              double timeout, double cpu_budget)
 {
   CEngine engine(v8::Isolate::GetCurrent());
 
@@ -237,12 +280,13 @@ py::object CContext::Evaluate(const std::string &src,
 
   BOOST_LOG_SEV(logger(), trace) << "eval script: " << src;
 
-  return script->Run();
+  return script->Run(timeout, cpu_budget);
 }
 
 py::object CContext::EvaluateW(const std::wstring &src,
                                const std::string name,
-                               int line, int col)
+                               int line, int col,
+                               double timeout, double cpu_budget)
 {
   CEngine engine(v8::Isolate::GetCurrent());
 
@@ -250,5 +294,49 @@ py::object CContext::EvaluateW(const std::wstring &src,
 
   BOOST_LOG_SEV(logger(), trace) << "eval script: " << src;
 
-  return script->Run();
+  return script->Run(timeout, cpu_budget);
+}
+
+py::object CContext::ParseJSON(py::object json)
+{
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  v8::HandleScope handle_scope(isolate);
+
+  v8::Handle<v8::Context> context = Context();
+
+  v8::Context::Scope context_scope(context);
+
+  v8::Handle<v8::String> text;
+
+  if (PyUnicode_Check(json.ptr()))
+  {
+    text = ToString(json, isolate);
+  }
+  else
+  {
+    Py_buffer buf;
+
+    if (0 != ::PyObject_GetBuffer(json.ptr(), &buf, PyBUF_SIMPLE))
+      py::throw_error_already_set();
+
+    v8::MaybeLocal<v8::String> str = v8::String::NewFromUtf8(isolate, static_cast<const char *>(buf.buf),
+                                                             v8::NewStringType::kNormal, (int) buf.len);
+
+    ::PyBuffer_Release(&buf);
+
+    if (str.IsEmpty())
+      throw CJavascriptException("JSON text too long", ::PyExc_ValueError);
+
+    text = str.ToLocalChecked();
+  }
+
+  v8::TryCatch try_catch(isolate);
+
+  v8::MaybeLocal<v8::Value> value = v8::JSON::Parse(context, text);
+
+  if (value.IsEmpty())
+    CJavascriptException::ThrowIf(isolate, try_catch);
+
+  return CJavascriptObject::Wrap(value.ToLocalChecked());
 }
@@ -7,16 +7,21 @@
 #include "Wrapper.h"
 #include "Utils.h"
 
+class CLivingMap;
+
 class CContext final
 {
+  v8::Isolate *m_isolate;
   v8::Persistent<v8::Context> m_context;
   py::object m_global;
+  CGILAccountPtr m_gil;
 
 private: // Embeded Data
   enum EmbedderDataFields
   {
     DebugIdIndex = v8::Context::kDebugIdIndex,
     LoggerIndex,
+    LivingMapIndex,
     GlobalObjectIndex,
   };
 
@@ -59,13 +64,31 @@ private: // Embeded Data
     return GetLogger(context);
   }
 
+public: // Identity Cache
+  // the slot lies within the embedder data V8 preallocates for every context, so it may be read from any context
+  static CLivingMap *GetLivingMap(v8::Handle<v8::Context> context)
+  {
+    v8::Local<v8::Value> value = context->GetEmbedderData(EmbedderDataFields::LivingMapIndex);
+
+    return value->IsExternal() ? static_cast<CLivingMap *>(v8::Local<v8::External>::Cast(value)->Value()) : NULL;
+  }
+
+  static void SetLivingMap(v8::Handle<v8::Context> context, CLivingMap *living)
+  {
+    if (living)
+      SetEmbedderData(context, EmbedderDataFields::LivingMapIndex, living);
+    else
+      context->SetEmbedderData(EmbedderDataFields::LivingMapIndex, v8::Undefined(context->GetIsolate()));
+  }
+
 public:
   CContext(v8::Handle<v8::Context> context, v8::Isolate *isolate = v8::Isolate::GetCurrent());
   CContext(const CContext &context, v8::Isolate *isolate = v8::Isolate::GetCurrent());
   CContext(py::object global, py::list extensions, v8::Isolate *isolate = v8::Isolate::GetCurrent());
   ~CContext() { Dispose(false); }
 
-  void Dispose(bool disposed = true, v8::Isolate *isolate = v8::Isolate::GetCurrent());
+  // the context is disposed within its own isolate, which may not be the current one when it's dropped
+  void Dispose(bool disposed = true, v8::Isolate *isolate = NULL);
 
   inline v8::Handle<v8::Context> Context(v8::Isolate *isolate = v8::Isolate::GetCurrent()) const { return m_context.Get(isolate); }
 
@@ -79,8 +102,18 @@ public:
   void Enter(void);
   void Leave(void);
 
-  py::object Evaluate(const std::string &src, const std::string name = std::string(), int line = -1, int col = -1);
-  py::object EvaluateW(const std::wstring &src, const std::string name = std::string(), int line = -1, int col = -1);
+  py::object Evaluate(const std::string &src, const std::string name = std::string(), int line = -1, int col = -1,
+                      double timeout = 0, double cpu_budget = 0);
+  py::object EvaluateW(const std::wstring &src, const std::string name = std::string(), int line = -1, int col = -1,
+                       double timeout = 0, double cpu_budget = 0);
+
+  py::object ParseJSON(py::object json);
+
+  bool IsBatchCallbacks(void) const { return m_gil->batched; }
+  void SetBatchCallbacks(bool batched) { m_gil->batched = batched; }
+
+  py::dict GetGILStatistics(void) const;
+  void ResetGILStatistics(void) { m_gil->Reset(); }
 
   static py::object GetEntered(v8::Isolate *isolate = v8::Isolate::GetCurrent());
   static py::object GetCurrent(v8::Isolate *isolate = v8::Isolate::GetCurrent());
@@ -1,14 +1,18 @@
 #include "Engine.h"
+#include "Watchdog.h"
 
 #include <iostream>
+#include <iomanip>
+#include <fstream>
 
 #include <boost/preprocessor.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
 
-#ifdef SUPPORT_SERIALIZE
-  CEngine::CounterTable CEngine::m_counters;
-#endif
+namespace fs = boost::filesystem;
 
 #ifdef SUPPORT_AST
   #include "AST.h"
@@ -93,10 +97,8 @@ MemoryAllocationManager::CallbackMap MemoryAllocationManager::s_callbacks;
 
 void CEngine::Expose(void)
 {
-#ifndef SUPPORT_SERIALIZE
   v8::V8::SetFatalErrorHandler(ReportFatalError);
   v8::V8::AddMessageListener(ReportMessage);
-#endif
 
 #ifdef SUPPORT_MEMORY_ALLOCATOR
   MemoryAllocationManager::Init();
@@ -139,15 +141,12 @@ void CEngine::Expose(void)
          "Performs a full garbage collection. Force compaction if the parameter is true.")
     .staticmethod("collect")
 
-  #ifdef SUPPORT_SERIALIZE
-    .add_static_property("serializeEnabled", &CEngine::IsSerializeEnabled, &CEngine::SetSerializeEnable)
-
-    .def("serialize", &CEngine::Serialize)
-    .staticmethod("serialize")
-
-    .def("deserialize", &CEngine::Deserialize)
-    .staticmethod("deserialize")
-  #endif
+    .def("createSnapshot", &CEngine::CreateSnapshot, (py::arg("script") = std::string(),
+                                                      py::arg("name") = std::string("<snapshot>"),
+                                                      py::arg("keep_code") = false),
+         "Run the script in a fresh context and create a startup snapshot of it, "
+         "which could be used to create a JSIsolate with the context pre-initialized.")
+    .staticmethod("createSnapshot")
 
     .def("terminateAllThreads", &CEngine::TerminateAllThreads,
          "Forcefully terminate the current thread of JavaScript execution.")
@@ -183,20 +182,47 @@ void CEngine::Expose(void)
     .staticmethod("setMemoryAllocationCallback")
   #endif
 
+    .add_static_property("compileCacheSize", &CEngine::GetCompileCacheSize,
+                         "The number of scripts in the compile cache of the current isolate.")
+    .add_static_property("compileCacheCapacity", &CEngine::GetCompileCacheCapacity, &CEngine::SetCompileCacheCapacity,
+                         "The maximum number of scripts in the compile cache, 0 to disable it.")
+    .add_static_property("compileCacheHits", &CEngine::GetCompileCacheHits,
+                         "The number of compilations served from the compile cache.")
+    .add_static_property("compileCacheMisses", &CEngine::GetCompileCacheMisses,
+                         "The number of compilations missed the compile cache.")
+    .add_static_property("compileCacheEvictions", &CEngine::GetCompileCacheEvictions,
+                         "The number of scripts evicted from the compile cache.")
+
+    .def("clearCompileCache", &CEngine::ClearCompileCache, "Drop all the scripts in the compile cache.")
+    .staticmethod("clearCompileCache")
+
+    .add_static_property("codeCacheDir", &CEngine::GetCodeCacheDirectory, &CEngine::SetCodeCacheDirectory,
+                         "The directory to persist the code cache of compiled scripts, empty to disable it.")
+
     .def("compile", &CEngine::Compile, (py::arg("source"),
                                         py::arg("name") = std::string(),
                                         py::arg("line") = -1,
-                                        py::arg("col") = -1))
+                                        py::arg("col") = -1,
+                                        py::arg("cached_data") = py::object()),
+         "Compile the script, or reuse it from the compile cache. "
+         "The cached_data from JSScript.codeCache is only consumed when the script has to be compiled, "
+         "it is ignored when the compiled script is still in the compile cache.")
     .def("compile", &CEngine::CompileW, (py::arg("source"),
                                          py::arg("name") = std::wstring(),
                                          py::arg("line") = -1,
-                                         py::arg("col") = -1))
+                                         py::arg("col") = -1,
+                                         py::arg("cached_data") = py::object()))
     ;
 
   py::class_<CScript, boost::noncopyable>("JSScript", "JSScript is a compiled JavaScript script.", py::no_init)
     .add_property("source", &CScript::GetSource, "the source code")
+    .add_property("codeCache", &CScript::GetCodeCache, "the code cache data of compiled script")
+    .add_property("codeCacheRejected", &CScript::IsCodeCacheRejected, "the code cache data was rejected by V8")
 
-    .def("run", &CScript::Run, "Execute the compiled code.")
+    .def("run", &CScript::Run, (py::arg("timeout") = 0.0,
+                                py::arg("cpu_budget") = 0.0),
+         "Execute the compiled code, terminate it with JSTimeoutError "
+         "when the timeout or CPU budget (in seconds) is exhausted.")
 
   #ifdef SUPPORT_AST
     .def("visit", &CScript::visit, (py::arg("handler"),
@@ -232,84 +258,67 @@ void CEngine::Expose(void)
 #endif
 }
 
-#ifdef SUPPORT_SERIALIZE
-
-int *CEngine::CounterLookup(const char* name)
+py::object CEngine::CreateSnapshot(const std::string& script, const std::string& name, bool keep_code)
 {
-  CounterTable::const_iterator it = m_counters.find(name);
-
-  if (it == m_counters.end())
-    m_counters[name] = 0;
-
-  return &m_counters[name];
-}
+  v8::StartupData blob;
 
-void CEngine::SetSerializeEnable(bool value)
-{
-  if (value)
-    v8i::Serializer::Enable();
-  else
-    v8i::Serializer::Disable();
-}
-bool CEngine::IsSerializeEnabled(void)
-{
-  return v8i::Serializer::enabled();
-}
+  {
+    v8::SnapshotCreator creator;
 
-struct PyBufferByteSink : public v8i::SnapshotByteSink
-{
-  std::vector<v8i::byte> m_data;
+    v8::Isolate *isolate = creator.GetIsolate();
 
-  virtual void Put(int byte, const char* description)
-  {
-    m_data.push_back(byte);
-  }
+    {
+      v8::Isolate::Scope isolate_scope(isolate);
+      v8::HandleScope handle_scope(isolate);
 
-  virtual int Position()
-  {
-    return (int) m_data.size();
-  }
-};
+      v8::Local<v8::Context> context = v8::Context::New(isolate);
 
-py::object CEngine::Serialize(void)
-{
-  v8::V8::Initialize();
+      if (!script.empty())
+      {
+        v8::Context::Scope context_scope(context);
 
-  PyBufferByteSink sink;
+        v8::TryCatch try_catch(isolate);
 
-  v8i::StartupSerializer serializer(&sink);
+        v8::ScriptOrigin script_origin(ToString(name, isolate));
 
-  serializer.Serialize();
+        v8::MaybeLocal<v8::Script> compiled = v8::Script::Compile(context, ToString(script, isolate), &script_origin);
 
-  py::object obj(py::handle<>(::PyByteArray_FromStringAndSize((const char *) &sink.m_data[0], sink.m_data.size())));
+        if (compiled.IsEmpty() || compiled.ToLocalChecked()->Run(context).IsEmpty())
+        {
+          // the exception can't outlive the snapshot isolate, so only its message is kept
 
-  return obj;
-}
-void CEngine::Deserialize(py::object snapshot)
-{
-  Py_buffer buf;
+          v8::String::Utf8Value msg(try_catch.Exception());
 
-  if (!snapshot.is_none() && PyObject_CheckBuffer(snapshot.ptr()))
-  {
-    if (0 == ::PyObject_GetBuffer(snapshot.ptr(), &buf, PyBUF_WRITABLE))
-    {
-      Py_BEGIN_ALLOW_THREADS
+          std::ostringstream oss;
 
-      v8i::SnapshotByteSource source((const v8i::byte *) buf.buf, (int) buf.len);
-      v8i::Deserializer deserializer(&source);
+          oss << "fail to run the snapshot script";
 
-      deserializer.Deserialize();
+          if (!try_catch.Message().IsEmpty())
+          {
+            oss << " at " << name << ":" << try_catch.Message()->GetLineNumber(context).FromMaybe(0);
+          }
 
-      v8i::V8::Initialize(&deserializer);
+          if (*msg) oss << ", " << *msg;
 
-      Py_END_ALLOW_THREADS
+          throw CJavascriptException(oss.str(), ::PyExc_RuntimeError);
+        }
+      }
 
-      ::PyBuffer_Release(&buf);
+      creator.SetDefaultContext(context);
     }
+
+    blob = creator.CreateBlob(keep_code ? v8::SnapshotCreator::FunctionCodeHandling::kKeep :
+                                          v8::SnapshotCreator::FunctionCodeHandling::kClear);
   }
-}
 
-#endif // SUPPORT_SERIALIZE
+  if (!blob.data) throw CJavascriptException("fail to create the startup snapshot", ::PyExc_RuntimeError);
+
+  py::object snapshot(py::handle<>(::PyBytes_FromStringAndSize(blob.data, blob.raw_size)));
+
+  delete[] blob.data;
+
+  return snapshot;
+}
 
 void CEngine::CollectAllGarbage(bool force_compaction)
 {
@@ -372,46 +381,320 @@ bool CEngine::SetStackLimit(uint32_t stack_limit_size)
   return true;
 }
 
+CCompileCache& CEngine::CompileCache(void)
+{
+  return CIsolate::Current().CompileCache();
+}
+
 boost::shared_ptr<CScript> CEngine::InternalCompile(v8::Handle<v8::String> src,
-                                                    v8::Handle<v8::Value> name,
+                                                    const std::string& name,
                                                     int line,
-                                                    int col)
+                                                    int col,
+                                                    size_t hash,
+                                                    py::object cached_data)
 {
   v8::HandleScope handle_scope(m_isolate);
 
   v8::TryCatch try_catch;
 
-  v8::MaybeLocal<v8::Script> script;
+  CCompileCache& cache = CIsolate(m_isolate).CompileCache();
+  CCompileCache::Key key(hash, name, line, col);
+  CCompileCache::EntryPtr entry = cache.Find(key, src);
+
+  if (entry && !entry->script.IsEmpty())
+  {
+    cache.Hit();
+
+    v8::Local<v8::UnboundScript> unbound = v8::Local<v8::UnboundScript>::New(m_isolate, entry->script);
+
+    return boost::shared_ptr<CScript>(new CScript(m_isolate, *this, src, unbound->BindToCurrentContext(), entry->code_cache));
+  }
+
+  size_t store_key = CCompileCache::KeyHash()(key);
+
+  CCodeCachePtr code_cache;
+
+  if (!cached_data.is_none())
+  {
+    Py_buffer buf;
+
+    if (0 != ::PyObject_GetBuffer(cached_data.ptr(), &buf, PyBUF_SIMPLE)) py::throw_error_already_set();
+
+    code_cache.reset(new CCodeCache(static_cast<const uint8_t *>(buf.buf), buf.len));
+
+    ::PyBuffer_Release(&buf);
+  }
+  else if (entry)
+  {
+    code_cache = entry->code_cache;
+  }
+  else if (CCodeCacheStore::IsEnabled())
+  {
+    code_cache = CCodeCacheStore::Load(store_key, hash, src->Length());
+  }
+
+  v8::MaybeLocal<v8::UnboundScript> unbound;
 
   v8::Local<v8::Integer> line_offset, column_offset;
 
   if (line >= 0) line_offset = v8::Integer::New(m_isolate, line);
   if (col >= 0) column_offset = v8::Integer::New(m_isolate, col);
 
-  Py_BEGIN_ALLOW_THREADS
+  v8::ScriptOrigin script_origin(ToString(name), line_offset, column_offset);
+
+  bool consume = code_cache && code_cache->Size() > 0;
 
-  v8::ScriptOrigin script_origin(name, line_offset, column_offset);
-  v8::ScriptCompiler::Source source(src, script_origin);
+  v8::ScriptCompiler::Source source(src, script_origin, consume ?
+    new v8::ScriptCompiler::CachedData(code_cache->Data(), (int) code_cache->Size()) : NULL);
 
-  script = v8::ScriptCompiler::Compile(m_isolate->GetCurrentContext(), &source);
+  {
+    CAllowThreads allow_threads;
 
-  Py_END_ALLOW_THREADS
+    unbound = v8::ScriptCompiler::CompileUnboundScript(m_isolate, &source, consume ?
+      v8::ScriptCompiler::kConsumeCodeCache : v8::ScriptCompiler::kProduceCodeCache);
+  }
 
 #ifdef SUPPORT_PROBES
   if (ENGINE_SCRIPT_COMPILE_ENABLED()) {
-    v8::String::Utf8Value s(source);
-    v8::String::Utf8Value n(v8::Handle<v8::String>::Cast(name));
+    v8::String::Utf8Value s(src);
 
-    ENGINE_SCRIPT_COMPILE(&script, *s, *n, line, col);
+    ENGINE_SCRIPT_COMPILE(&unbound, *s, name.c_str(), line, col);
   }
 #endif
 
-  if (script.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+  if (unbound.IsEmpty()) CJavascriptException::ThrowIf(m_isolate, try_catch);
+
+  bool rejected = consume && source.GetCachedData()->rejected;
+
+  if (rejected)
+  {
+    if (code_cache->IsMapped()) CCodeCacheStore::Remove(store_key);
+
+    code_cache.reset();
+  }
+  else if (!consume)
+  {
+    const v8::ScriptCompiler::CachedData *produced = source.GetCachedData();
+
+    if (produced && produced->length > 0)
+    {
+      code_cache.reset(new CCodeCache(produced->data, produced->length));
+
+      if (CCodeCacheStore::IsEnabled()) CCodeCacheStore::Save(store_key, hash, src->Length(), code_cache);
+    }
+  }
+
+  if (entry)
+  {
+    // the unbound script was collected and rebuilt from the code cache
+
+    entry->script.Reset(m_isolate, unbound.ToLocalChecked());
+    entry->script.SetWeak();
+    entry->code_cache = code_cache;
+
+    cache.Hit();
+  }
+  else
+  {
+    cache.Miss();
+
+    entry = cache.Insert(key, src, unbound.ToLocalChecked());
+
+    if (entry) entry->code_cache = code_cache;
+  }
+
+  return boost::shared_ptr<CScript>(new CScript(m_isolate, *this, src, unbound.ToLocalChecked()->BindToCurrentContext(),
+                                                code_cache, rejected));
+}
+
+CCompileCache::EntryPtr CCompileCache::Find(const Key& key, v8::Handle<v8::String> source)
+{
+  if (!m_capacity) return EntryPtr();
+
+  EntryIndex::iterator it = m_index.find(key);
+
+  if (it == m_index.end()) return EntryPtr();
+
+  EntryPtr entry = *it->second;
+
+  if (!entry->source.Get(m_isolate)->StrictEquals(source)) return EntryPtr();
+
+  if (entry->script.IsEmpty() && !entry->code_cache)
+  {
+    m_entries.erase(it->second);
+    m_index.erase(it);
+
+    return EntryPtr();
+  }
+
+  m_entries.splice(m_entries.begin(), m_entries, it->second);
+
+  return entry;
+}
+
+CCompileCache::EntryPtr CCompileCache::Insert(const Key& key, v8::Handle<v8::String> source, v8::Handle<v8::UnboundScript> script)
+{
+  if (!m_capacity) return EntryPtr();
+
+  EntryIndex::iterator it = m_index.find(key);
+
+  if (it != m_index.end())
+  {
+    m_entries.erase(it->second);
+    m_index.erase(it);
+  }
+
+  EntryPtr entry(new Entry(key));
+
+  entry->source.Reset(m_isolate, source);
+  entry->script.Reset(m_isolate, script);
+  entry->script.SetWeak();
+
+  m_entries.push_front(entry);
+  m_index[key] = m_entries.begin();
+
+  Evict(m_capacity);
+
+  return entry;
+}
+
+void CCompileCache::Evict(size_t capacity)
+{
+  while (m_entries.size() > capacity)
+  {
+    m_index.erase(m_entries.back()->key);
+    m_entries.pop_back();
+
+    m_evictions++;
+  }
+}
+
+std::string CCodeCacheStore::s_directory;
+
+struct CodeCacheHeader
+{
+  char magic[8];
+  char version[32];
+
+  uint64_t key;
+  uint64_t source_hash;
+  uint64_t source_length;
+  uint64_t data_length;
+};
+
+static const char CODE_CACHE_MAGIC[8] = { 'P', 'Y', 'V', '8', 'J', 'S', 'C', '1' };
+
+const std::string CCodeCacheStore::GetPath(size_t key)
+{
+  std::ostringstream oss;
+
+  oss << std::hex << std::setw(sizeof(key) * 2) << std::setfill('0') << key << ".jsc";
 
-  return boost::shared_ptr<CScript>(new CScript(m_isolate, *this, src, script.ToLocalChecked()));
+  return (fs::path(s_directory) / oss.str()).string();
 }
 
-py::object CEngine::ExecuteScript(v8::Handle<v8::Script> script)
+CCodeCachePtr CCodeCacheStore::Load(size_t key, size_t source_hash, size_t source_length)
+{
+  namespace ipc = boost::interprocess;
+
+  const std::string path = GetPath(key);
+
+  boost::system::error_code ec;
+
+  uintmax_t file_size = fs::file_size(path, ec);
+
+  if (ec || file_size <= sizeof(CodeCacheHeader)) return CCodeCachePtr();
+
+  try
+  {
+    ipc::file_mapping mapping(path.c_str(), ipc::read_only);
+    boost::shared_ptr<ipc::mapped_region> region(new ipc::mapped_region(mapping, ipc::read_only));
+
+    const CodeCacheHeader *header = static_cast<const CodeCacheHeader *>(region->get_address());
+
+    if (region->get_size() < sizeof(CodeCacheHeader) ||
+        0 != memcmp(header->magic, CODE_CACHE_MAGIC, sizeof(header->magic)) ||
+        0 != strncmp(header->version, CEngine::GetVersion().c_str(), sizeof(header->version)) ||
+        header->key != key || header->source_hash != source_hash || header->source_length != source_length ||
+        header->data_length != region->get_size() - sizeof(CodeCacheHeader))
+    {
+      BOOST_LOG_SEV(CIsolate::Current().Logger(), warning) << "drop invalid code cache " << path;
+
+      Remove(key);
+
+      return CCodeCachePtr();
+    }
+
+    BOOST_LOG_SEV(CIsolate::Current().Logger(), debug) << "load code cache from " << path;
+
+    return CCodeCachePtr(new CCodeCache(region, reinterpret_cast<const uint8_t *>(header + 1), header->data_length));
+  }
+  catch (const ipc::interprocess_exception& ex)
+  {
+    BOOST_LOG_SEV(CIsolate::Current().Logger(), warning) << "fail to map code cache " << path << ", " << ex.what();
+  }
+
+  return CCodeCachePtr();
+}
+
+void CCodeCacheStore::Save(size_t key, size_t source_hash, size_t source_length, CCodeCachePtr code_cache)
+{
+  const std::string path = GetPath(key);
+
+  std::ostringstream tmp_path;
+
+  // a unique name so concurrent processes never write the same temporary file
+  tmp_path << path << "." << fs::unique_path().string() << ".tmp";
+
+  CodeCacheHeader header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CODE_CACHE_MAGIC, sizeof(header.magic));
+  strncpy(header.version, CEngine::GetVersion().c_str(), sizeof(header.version));
+
+  header.key = key;
+  header.source_hash = source_hash;
+  header.source_length = source_length;
+  header.data_length = code_cache->Size();
+
+  {
+    std::ofstream file(tmp_path.str().c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(code_cache->Data()), code_cache->Size());
+
+    if (!file)
+    {
+      BOOST_LOG_SEV(CIsolate::Current().Logger(), warning) << "fail to write code cache " << tmp_path.str();
+
+      return;
+    }
+  }
+
+  boost::system::error_code ec;
+
+  fs::rename(tmp_path.str(), path, ec);
+
+  if (ec)
+  {
+    BOOST_LOG_SEV(CIsolate::Current().Logger(), warning) << "fail to save code cache " << path << ", " << ec.message();
+
+    fs::remove(tmp_path.str(), ec);
+  }
+  else
+  {
+    BOOST_LOG_SEV(CIsolate::Current().Logger(), debug) << "save code cache to " << path;
+  }
+}
+
+void CCodeCacheStore::Remove(size_t key)
+{
+  boost::system::error_code ec;
+
+  fs::remove(GetPath(key), ec);
+}
+
+py::object CEngine::ExecuteScript(v8::Handle<v8::Script> script, double timeout, double cpu_budget)
 {
 #ifdef SUPPORT_PROBES
   if (ENGINE_SCRIPT_RUN_ENABLED()) {
@@ -425,11 +708,29 @@ py::object CEngine::ExecuteScript(v8::Handle<v8::Script> script)
 
   v8::Handle<v8::Value> result;
 
-  Py_BEGIN_ALLOW_THREADS
+  CWatchdog::Scope watchdog(m_isolate, timeout, cpu_budget);
+  CHeapMonitor::Scope heap_scope(m_isolate);
+
+  {
+    CAllowThreads allow_threads;
 
-  result = script->Run();
+    // under the scoped microtask policy, the queued microtasks run when the outermost script or call returns
+    v8::MicrotasksScope microtasks(m_isolate, v8::MicrotasksScope::kRunMicrotasks);
 
-  Py_END_ALLOW_THREADS
+    result = script->Run();
+  }
+
+  if (watchdog.Disarm())
+  {
+    // the termination may race with a normal completion, cancel it in any case
+    m_isolate->CancelTerminateExecution();
+
+    if (result.IsEmpty())
+      throw CJavascriptException(std::string("script execution exceeded its ") + watchdog.GetReason(),
+                                 CWatchdog::TimeoutError());
+  }
+
+  heap_scope.Check(result.IsEmpty());
 
   if (result.IsEmpty())
   {
@@ -486,6 +787,14 @@ void CScript::visit(py::object handler, v8i::LanguageMode mode) const
 
 #endif
 
+py::object CScript::GetCodeCache(void) const
+{
+  if (!m_code_cache) return py::object();
+
+  return py::object(py::handle<>(::PyBytes_FromStringAndSize(reinterpret_cast<const char *>(m_code_cache->Data()),
+                                                             m_code_cache->Size())));
+}
+
 const std::string CScript::GetSource(void) const
 {
   v8::HandleScope handle_scope(m_isolate);
@@ -495,11 +804,11 @@ const std::string CScript::GetSource(void) const
   return std::string(*source, source.length());
 }
 
-py::object CScript::Run(void)
+py::object CScript::Run(double timeout, double cpu_budget)
 {
   v8::HandleScope handle_scope(m_isolate);
 
-  return m_engine.ExecuteScript(Script());
+  return m_engine.ExecuteScript(Script(), timeout, cpu_budget);
 }
 
 #ifdef SUPPORT_EXTENSION
@@ -514,35 +823,7 @@ class CPythonExtension : public v8::Extension
     CPythonGIL python_gil;
     py::object func = *static_cast<py::object *>(v8::External::Cast(*args.Data())->Value());
 
-    py::object result;
-
-    switch (args.Length())
-    {
-    case 0: result = func(); break;
-    case 1: result = func(CJavascriptObject::Wrap(args[0])); break;
-    case 2: result = func(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1])); break;
-    case 3: result = func(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]),
-                          CJavascriptObject::Wrap(args[2])); break;
-    case 4: result = func(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]),
-                          CJavascriptObject::Wrap(args[2]), CJavascriptObject::Wrap(args[3])); break;
-    case 5: result = func(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]),
-                          CJavascriptObject::Wrap(args[2]), CJavascriptObject::Wrap(args[3]),
-                          CJavascriptObject::Wrap(args[4])); break;
-    case 6: result = func(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]),
-                          CJavascriptObject::Wrap(args[2]), CJavascriptObject::Wrap(args[3]),
-                          CJavascriptObject::Wrap(args[4]), CJavascriptObject::Wrap(args[5])); break;
-    case 7: result = func(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]),
-                          CJavascriptObject::Wrap(args[2]), CJavascriptObject::Wrap(args[3]),
-                          CJavascriptObject::Wrap(args[4]), CJavascriptObject::Wrap(args[5]),
-                          CJavascriptObject::Wrap(args[6])); break;
-    case 8: result = func(CJavascriptObject::Wrap(args[0]), CJavascriptObject::Wrap(args[1]),
-                          CJavascriptObject::Wrap(args[2]), CJavascriptObject::Wrap(args[3]),
-                          CJavascriptObject::Wrap(args[4]), CJavascriptObject::Wrap(args[5]),
-                          CJavascriptObject::Wrap(args[7]), CJavascriptObject::Wrap(args[8])); break;
-    default:
-      args.GetIsolate()->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(args.GetIsolate(), "too many arguments")));
-      break;
-    }
+    py::object result = CPythonObject::Apply(func.ptr(), args);
 
     if (result.is_none()) {
       args.GetReturnValue().SetNull();
@@ -2,9 +2,12 @@
 
 #include <string>
 #include <vector>
+#include <list>
 #include <map>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
 
 #include "Isolate.h"
 #include "Context.h"
@@ -12,25 +15,162 @@
 
 #include "V8Internal.h"
 
+namespace boost { namespace interprocess { class mapped_region; } }
+
 class CScript;
 
 typedef boost::shared_ptr<CScript> CScriptPtr;
 
-class CEngine
+//
+// Immutable V8 code cache data, either owned or memory-mapped from the on-disk store.
+//
+class CCodeCache : private boost::noncopyable
+{
+  std::vector<uint8_t> m_data;
+  boost::shared_ptr<boost::interprocess::mapped_region> m_region;
+
+  const uint8_t *m_ptr;
+  size_t m_size;
+public:
+  CCodeCache(const uint8_t *data, size_t size)
+    : m_data(data, data + size), m_ptr(m_data.empty() ? NULL : &m_data[0]), m_size(size)
+  {
+  }
+
+  CCodeCache(boost::shared_ptr<boost::interprocess::mapped_region> region, const uint8_t *data, size_t size)
+    : m_region(region), m_ptr(data), m_size(size)
+  {
+  }
+
+  const uint8_t *Data(void) const { return m_ptr; }
+  size_t Size(void) const { return m_size; }
+
+  bool IsMapped(void) const { return m_region.get() != NULL; }
+};
+
+typedef boost::shared_ptr<const CCodeCache> CCodeCachePtr;
+
+//
+// On-disk store of code cache, one file per script, validated against the source hash and V8 version.
+//
+class CCodeCacheStore
 {
+  static std::string s_directory;
+
+  static const std::string GetPath(size_t key);
+public:
+  static const std::string GetDirectory(void) { return s_directory; }
+  static void SetDirectory(const std::string& directory) { s_directory = directory; }
+
+  static bool IsEnabled(void) { return !s_directory.empty(); }
+
+  static CCodeCachePtr Load(size_t key, size_t source_hash, size_t source_length);
+  static void Save(size_t key, size_t source_hash, size_t source_length, CCodeCachePtr code_cache);
+  static void Remove(size_t key);
+};
+
+//
+// Per-isolate LRU cache of compiled scripts, keyed by the source hash and the script origin.
+//
+// The unbound scripts are held weakly, so V8 may collect the cold ones under memory pressure;
+// the code cache data is kept with the entry and used to rebuild the script without parsing.
+//
+class CCompileCache : private boost::noncopyable
+{
+public:
+  struct Key
+  {
+    size_t hash;
+    std::string name;
+    int line, col;
+
+    Key(size_t hash, const std::string& name, int line, int col)
+      : hash(hash), name(name), line(line), col(col)
+    {
+    }
+
+    bool operator==(const Key& other) const
+    {
+      return hash == other.hash && line == other.line && col == other.col && name == other.name;
+    }
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const
+    {
+      size_t seed = key.hash;
+
+      boost::hash_combine(seed, key.name);
+      boost::hash_combine(seed, key.line);
+      boost::hash_combine(seed, key.col);
+
+      return seed;
+    }
+  };
+
+  struct Entry : private boost::noncopyable
+  {
+    Key key;
+
+    v8::Persistent<v8::String> source;
+    v8::Persistent<v8::UnboundScript> script;
+
+    CCodeCachePtr code_cache;
+
+    Entry(const Key& key) : key(key) {}
+    ~Entry() { source.Reset(); script.Reset(); }
+  };
+
+  typedef boost::shared_ptr<Entry> EntryPtr;
+
+  static const size_t DEFAULT_CAPACITY = 64;
+private:
+  typedef std::list<EntryPtr> EntryList;
+  typedef boost::unordered_map<Key, EntryList::iterator, KeyHash> EntryIndex;
+
   v8::Isolate *m_isolate;
+  size_t m_capacity;
 
-  static uint32_t *CalcStackLimitSize(uint32_t size);
-protected:
-  CScriptPtr InternalCompile(v8::Handle<v8::String> src, v8::Handle<v8::Value> name, int line, int col);
+  EntryList m_entries; // most recently used first
+  EntryIndex m_index;
 
-#ifdef SUPPORT_SERIALIZE
+  size_t m_hits, m_misses, m_evictions;
 
-  typedef std::map<std::string, int> CounterTable;
-  static CounterTable m_counters;
+  void Evict(size_t capacity);
+public:
+  CCompileCache(v8::Isolate *isolate, size_t capacity = DEFAULT_CAPACITY)
+    : m_isolate(isolate), m_capacity(capacity), m_hits(0), m_misses(0), m_evictions(0)
+  {
+  }
 
-  static int *CounterLookup(const char* name);
-#endif
+  EntryPtr Find(const Key& key, v8::Handle<v8::String> source);
+  EntryPtr Insert(const Key& key, v8::Handle<v8::String> source, v8::Handle<v8::UnboundScript> script);
+
+  void Hit(void) { m_hits++; }
+  void Miss(void) { m_misses++; }
+
+  void Clear(void) { m_index.clear(); m_entries.clear(); }
+
+  size_t GetSize(void) const { return m_entries.size(); }
+  size_t GetCapacity(void) const { return m_capacity; }
+  void SetCapacity(size_t capacity) { m_capacity = capacity; Evict(capacity); }
+
+  size_t GetHits(void) const { return m_hits; }
+  size_t GetMisses(void) const { return m_misses; }
+  size_t GetEvictions(void) const { return m_evictions; }
+};
+
+class CEngine
+{
+  v8::Isolate *m_isolate;
+
+  static uint32_t *CalcStackLimitSize(uint32_t size);
+
+  static CCompileCache& CompileCache(void);
+protected:
+  CScriptPtr InternalCompile(v8::Handle<v8::String> src, const std::string& name, int line, int col,
+                             size_t hash, py::object cached_data);
 
   static void CollectAllGarbage(bool force_compaction);
   static void TerminateAllThreads(void);
@@ -40,18 +180,20 @@ protected:
 public:
   CEngine(v8::Isolate *isolate = NULL) : m_isolate(isolate ? isolate : v8::Isolate::GetCurrent()) {}
 
-  CScriptPtr Compile(const std::string& src, const std::string name = std::string(), int line = -1, int col = -1)
+  CScriptPtr Compile(const std::string& src, const std::string name = std::string(), int line = -1, int col = -1,
+                     py::object cached_data = py::object())
   {
     v8::HandleScope scope(m_isolate);
 
-    return InternalCompile(ToString(src), ToString(name), line, col);
+    return InternalCompile(ToString(src), name, line, col, boost::hash_value(src), cached_data);
   }
 
-  CScriptPtr CompileW(const std::wstring& src, const std::string name = std::string(), int line = -1, int col = -1)
+  CScriptPtr CompileW(const std::wstring& src, const std::string name = std::string(), int line = -1, int col = -1,
+                      py::object cached_data = py::object())
   {
     v8::HandleScope scope(m_isolate);
 
-    return InternalCompile(ToString(src), ToString(name), line, col);
+    return InternalCompile(ToString(src), name, line, col, boost::hash_value(src), cached_data);
   }
 
   void RaiseError(v8::TryCatch& try_catch);
@@ -63,15 +205,22 @@ public:
   static bool SetMemoryLimit(int max_semi_space_size, int max_old_space_size, int max_executable_size, int code_range_size);
   static bool SetStackLimit(uint32_t stack_limit_size);
 
-  py::object ExecuteScript(v8::Handle<v8::Script> script);
+  py::object ExecuteScript(v8::Handle<v8::Script> script, double timeout = 0, double cpu_budget = 0);
 
   static void SetFlags(const std::string& flags) { v8::V8::SetFlagsFromString(flags.c_str(), flags.size()); }
 
-  static void SetSerializeEnable(bool value);
-  static bool IsSerializeEnabled(void);
+  static size_t GetCompileCacheSize(void) { return CompileCache().GetSize(); }
+  static size_t GetCompileCacheCapacity(void) { return CompileCache().GetCapacity(); }
+  static void SetCompileCacheCapacity(size_t capacity) { CompileCache().SetCapacity(capacity); }
+  static size_t GetCompileCacheHits(void) { return CompileCache().GetHits(); }
+  static size_t GetCompileCacheMisses(void) { return CompileCache().GetMisses(); }
+  static size_t GetCompileCacheEvictions(void) { return CompileCache().GetEvictions(); }
+  static void ClearCompileCache(void) { CompileCache().Clear(); }
+
+  static const std::string GetCodeCacheDirectory(void) { return CCodeCacheStore::GetDirectory(); }
+  static void SetCodeCacheDirectory(const std::string& directory) { CCodeCacheStore::SetDirectory(directory); }
 
-  static py::object Serialize(void);
-  static void Deserialize(py::object snapshot);
+  static py::object CreateSnapshot(const std::string& script, const std::string& name, bool keep_code);
 };
 
 class CScript
@@ -81,15 +230,21 @@ class CScript
 
   v8::Persistent<v8::String> m_source;
   v8::Persistent<v8::Script> m_script;
+
+  CCodeCachePtr m_code_cache;
+  bool m_code_cache_rejected;
 public:
-  CScript(v8::Isolate *isolate, CEngine& engine, v8::Handle<v8::String> source, v8::Handle<v8::Script> script)
-    : m_isolate(isolate), m_engine(engine), m_source(m_isolate, source), m_script(m_isolate, script)
+  CScript(v8::Isolate *isolate, CEngine& engine, v8::Handle<v8::String> source, v8::Handle<v8::Script> script,
+          CCodeCachePtr code_cache = CCodeCachePtr(), bool code_cache_rejected = false)
+    : m_isolate(isolate), m_engine(engine), m_source(m_isolate, source), m_script(m_isolate, script),
+      m_code_cache(code_cache), m_code_cache_rejected(code_cache_rejected)
   {
 
   }
 
   CScript(const CScript& script)
-    : m_isolate(script.m_isolate), m_engine(script.m_engine)
+    : m_isolate(script.m_isolate), m_engine(script.m_engine),
+      m_code_cache(script.m_code_cache), m_code_cache_rejected(script.m_code_cache_rejected)
   {
     v8::HandleScope handle_scope(m_isolate);
 
@@ -99,6 +254,8 @@ public:
 
   ~CScript()
   {
+    CDisposeLocker locker(m_isolate);
+
     m_source.Reset();
     m_script.Reset();
   }
@@ -112,7 +269,10 @@ public:
 
   const std::string GetSource(void) const;
 
-  py::object Run(void);
+  py::object GetCodeCache(void) const;
+  bool IsCodeCacheRejected(void) const { return m_code_cache_rejected; }
+
+  py::object Run(double timeout = 0, double cpu_budget = 0);
 };
 
 #ifdef SUPPORT_EXTENSION
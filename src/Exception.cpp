@@ -2,6 +2,8 @@
 
 #include <sstream>
 
+#include "Isolate.h"
+
 std::ostream& operator<<(std::ostream& os, const CJavascriptException& ex)
 {
   os << "JSError: " << ex.what();
@@ -157,7 +159,7 @@ const std::string CJavascriptStackFrame::GetFunctionName() const
 }
 const std::string CJavascriptException::GetName(void)
 {
-  if (m_exc.IsEmpty()) return std::string();
+  if (!m_caught) return std::string();
 
   assert(m_isolate->InContext());
 
@@ -169,7 +171,7 @@ const std::string CJavascriptException::GetName(void)
 }
 const std::string CJavascriptException::GetMessage(void)
 {
-  if (m_exc.IsEmpty()) return std::string();
+  if (!m_caught) return std::string();
 
   assert(m_isolate->InContext());
 
@@ -185,7 +187,7 @@ const std::string CJavascriptException::GetScriptName(void)
 
   v8::HandleScope handle_scope(m_isolate);
 
-  if (!m_msg.IsEmpty() && !Message()->GetScriptResourceName().IsEmpty() &&
+  if (!Message().IsEmpty() && !Message()->GetScriptResourceName().IsEmpty() &&
       !Message()->GetScriptResourceName()->IsUndefined())
   {
     v8::String::Utf8Value name(Message()->GetScriptResourceName());
@@ -201,7 +203,7 @@ int CJavascriptException::GetLineNumber(void)
 
   v8::HandleScope handle_scope(m_isolate);
 
-  return m_msg.IsEmpty() ? 1 : Message()->GetLineNumber();
+  return Message().IsEmpty() ? 1 : Message()->GetLineNumber();
 }
 int CJavascriptException::GetStartPosition(void)
 {
@@ -209,7 +211,7 @@ int CJavascriptException::GetStartPosition(void)
 
   v8::HandleScope handle_scope(m_isolate);
 
-  return m_msg.IsEmpty() ? 1 : Message()->GetStartPosition();
+  return Message().IsEmpty() ? 1 : Message()->GetStartPosition();
 }
 int CJavascriptException::GetEndPosition(void)
 {
@@ -217,7 +219,7 @@ int CJavascriptException::GetEndPosition(void)
 
   v8::HandleScope handle_scope(m_isolate);
 
-  return m_msg.IsEmpty() ? 1 : Message()->GetEndPosition();
+  return Message().IsEmpty() ? 1 : Message()->GetEndPosition();
 }
 int CJavascriptException::GetStartColumn(void)
 {
@@ -225,7 +227,7 @@ int CJavascriptException::GetStartColumn(void)
 
   v8::HandleScope handle_scope(m_isolate);
 
-  return m_msg.IsEmpty() ? 1 : Message()->GetStartColumn();
+  return Message().IsEmpty() ? 1 : Message()->GetStartColumn();
 }
 int CJavascriptException::GetEndColumn(void)
 {
@@ -233,7 +235,7 @@ int CJavascriptException::GetEndColumn(void)
 
   v8::HandleScope handle_scope(m_isolate);
 
-  return m_msg.IsEmpty() ? 1 : Message()->GetEndColumn();
+  return Message().IsEmpty() ? 1 : Message()->GetEndColumn();
 }
 const std::string CJavascriptException::GetSourceLine(void)
 {
@@ -241,7 +243,7 @@ const std::string CJavascriptException::GetSourceLine(void)
 
   v8::HandleScope handle_scope(m_isolate);
 
-  if (!m_msg.IsEmpty() && !Message()->GetSourceLine().IsEmpty() &&
+  if (!Message().IsEmpty() && !Message()->GetSourceLine().IsEmpty() &&
       !Message()->GetSourceLine()->IsUndefined())
   {
     v8::String::Utf8Value line(Message()->GetSourceLine());
@@ -257,7 +259,7 @@ const std::string CJavascriptException::GetStackTrace(void)
 
   v8::HandleScope handle_scope(m_isolate);
 
-  if (!m_stack.IsEmpty())
+  if (!Stack().IsEmpty())
   {
     v8::String::Utf8Value stack(v8::Handle<v8::String>::Cast(Stack()));
 
@@ -266,20 +268,63 @@ const std::string CJavascriptException::GetStackTrace(void)
 
   return std::string();
 }
-const std::string CJavascriptException::Extract(v8::Isolate *isolate, v8::TryCatch& try_catch)
+CCaughtException::CCaughtException(v8::Isolate *isolate, v8::TryCatch& try_catch)
+  : m_isolate(isolate), m_formatted(false)
 {
   assert(isolate->InContext());
 
-  v8::HandleScope handle_scope(isolate);
+  v8::HandleScope handle_scope(m_isolate);
+
+  m_context.Reset(m_isolate, m_isolate->GetCurrentContext());
+  m_exc.Reset(m_isolate, try_catch.Exception());
+  m_stack.Reset(m_isolate, try_catch.StackTrace());
+  m_msg.Reset(m_isolate, try_catch.Message());
+}
+
+CCaughtException::~CCaughtException()
+{
+  // the handles went away with a disposed isolate
+  if (!CManagedIsolate::IsAlive(m_isolate))
+    return;
+
+  CDisposeLocker locker(m_isolate);
+
+  m_context.Reset();
+  m_exc.Reset();
+  m_stack.Reset();
+  m_msg.Reset();
+}
+
+void CCaughtException::Format(void)
+{
+  m_formatted = true;
+
+  // the exception may be read on another thread, even after its isolate has been disposed
+  if (!CManagedIsolate::IsAlive(m_isolate))
+  {
+    m_what = "the isolate of the exception has been disposed";
+
+    return;
+  }
+
+  CDisposeLocker locker(m_isolate);
+
+  v8::Isolate::Scope isolate_scope(m_isolate);
+  v8::HandleScope handle_scope(m_isolate);
+
+  v8::Context::Scope context_scope(Context());
+
+  // the exception may run a toString which throws in turn
+  v8::TryCatch try_catch(m_isolate);
 
   std::ostringstream oss;
 
-  v8::String::Utf8Value msg(try_catch.Exception());
+  v8::String::Utf8Value msg(Exception());
 
   if (*msg)
     oss << std::string(*msg, msg.length());
 
-  v8::Handle<v8::Message> message = try_catch.Message();
+  v8::Handle<v8::Message> message = Message();
 
   if (!message.IsEmpty())
   {
@@ -304,7 +349,21 @@ const std::string CJavascriptException::Extract(v8::Isolate *isolate, v8::TryCat
     }
   }
 
-  return oss.str();
+  m_what = oss.str();
+}
+
+const char *CJavascriptException::what() const throw()
+{
+  if (!m_caught) return std::runtime_error::what();
+
+  try
+  {
+    return m_caught->What().c_str();
+  }
+  catch (const std::exception&)
+  {
+    return std::runtime_error::what();
+  }
 }
 
 static struct {
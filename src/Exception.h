@@ -4,6 +4,7 @@
 #include <stdexcept>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/iterator/iterator_facade.hpp>
 
 #include "Config.h"
@@ -114,26 +115,50 @@ public:
   bool IsConstructor() const { v8::HandleScope handle_scope(m_isolate); return Handle()->IsConstructor(); }
 };
 
-class CJavascriptException : public std::runtime_error
+//
+// The exception, stack and message caught by a TryCatch, shared by all the copies of a CJavascriptException,
+// so the exception may be copied (e.g. when it is translated to Python) without creating any handle.
+// The description is only formatted when it is read, in the context where the exception was caught,
+// with the isolate locked if it's read on another thread, as long as the isolate is alive.
+//
+class CCaughtException : private boost::noncopyable
 {
   v8::Isolate *m_isolate;
-  PyObject *m_type;
 
+  v8::Persistent<v8::Context> m_context;
   v8::Persistent<v8::Value> m_exc, m_stack;
   v8::Persistent<v8::Message> m_msg;
 
-  friend struct ExceptionTranslator;
+  bool m_formatted;
+  std::string m_what;
+
+  void Format(void);
+public:
+  CCaughtException(v8::Isolate *isolate, v8::TryCatch& try_catch);
+  ~CCaughtException();
+
+  v8::Handle<v8::Context> Context() const { return v8::Local<v8::Context>::New(m_isolate, m_context); }
+  v8::Handle<v8::Value> Exception() const { return v8::Local<v8::Value>::New(m_isolate, m_exc); }
+  v8::Handle<v8::Value> Stack() const { return v8::Local<v8::Value>::New(m_isolate, m_stack); }
+  v8::Handle<v8::Message> Message() const { return v8::Local<v8::Message>::New(m_isolate, m_msg); }
+
+  const std::string& What(void) { if (!m_formatted) Format(); return m_what; }
+};
+
+typedef boost::shared_ptr<CCaughtException> CCaughtExceptionPtr;
 
-  static const std::string Extract(v8::Isolate *isolate, v8::TryCatch& try_catch);
+class CJavascriptException : public std::runtime_error
+{
+  v8::Isolate *m_isolate;
+  PyObject *m_type;
+
+  CCaughtExceptionPtr m_caught;
+
+  friend struct ExceptionTranslator;
 protected:
   CJavascriptException(v8::Isolate *isolate, v8::TryCatch& try_catch, PyObject *type)
-    : std::runtime_error(Extract(isolate, try_catch)), m_isolate(isolate), m_type(type)
+    : std::runtime_error(std::string()), m_isolate(isolate), m_type(type), m_caught(new CCaughtException(isolate, try_catch))
   {
-    v8::HandleScope handle_scope(m_isolate);
-
-    m_exc.Reset(m_isolate, try_catch.Exception());
-    m_stack.Reset(m_isolate, try_catch.StackTrace());
-    m_msg.Reset(m_isolate, try_catch.Message());
   }
 public:
   CJavascriptException(const std::string& msg, PyObject *type = NULL)
@@ -141,25 +166,11 @@ public:
   {
   }
 
-  CJavascriptException(const CJavascriptException& ex)
-    : std::runtime_error(ex.what()), m_isolate(ex.m_isolate), m_type(ex.m_type)
-  {
-    v8::HandleScope handle_scope(m_isolate);
+  virtual const char *what() const throw();
 
-    m_exc.Reset(m_isolate, ex.Exception());
-    m_stack.Reset(m_isolate, ex.Stack());
-    m_msg.Reset(m_isolate, ex.Message());
-  }
-
-  ~CJavascriptException() throw()
-  {
-    if (!m_exc.IsEmpty()) m_exc.Reset();
-    if (!m_msg.IsEmpty()) m_msg.Reset();
-  }
-
-  v8::Handle<v8::Value> Exception() const { return v8::Local<v8::Value>::New(m_isolate, m_exc); }
-  v8::Handle<v8::Value> Stack() const { return v8::Local<v8::Value>::New(m_isolate, m_stack); }
-  v8::Handle<v8::Message> Message() const { return v8::Local<v8::Message>::New(m_isolate, m_msg); }
+  v8::Handle<v8::Value> Exception() const { return m_caught ? m_caught->Exception() : v8::Handle<v8::Value>(); }
+  v8::Handle<v8::Value> Stack() const { return m_caught ? m_caught->Stack() : v8::Handle<v8::Value>(); }
+  v8::Handle<v8::Message> Message() const { return m_caught ? m_caught->Message() : v8::Handle<v8::Message>(); }
 
   const std::string GetName(void);
   const std::string GetMessage(void);
@@ -1,11 +1,31 @@
 #include "Isolate.h"
 
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+
+#include "Engine.h"
+#include "Locker.h"
+
+boost::mutex CManagedIsolate::s_alive_lock;
+std::set<v8::Isolate *> CManagedIsolate::s_alive;
+
 void CManagedIsolate::Expose(void)
 {
+    py::enum_<v8::MicrotasksPolicy>("JSMicrotaskPolicy")
+        .value("explicit", v8::MicrotasksPolicy::kExplicit)
+        .value("scoped", v8::MicrotasksPolicy::kScoped)
+        .value("auto", v8::MicrotasksPolicy::kAuto);
+
     py::class_<CIsolateWrapper, boost::noncopyable>("JSIsolate", py::no_init)
         .add_property("locked", &CIsolateWrapper::IsLocked)
         .add_property("used", &CIsolateWrapper::InUse, "Check if this isolate is in use.")
 
+        // the wrappers of the same isolate are equal, e.g. JSIsolate.current of different threads
+        .def("__eq__", &CIsolateWrapper::Equals)
+        .def("__ne__", &CIsolateWrapper::Unequals)
+        .def("__hash__", &CIsolateWrapper::Hash)
+
         .def("enter", &CIsolateWrapper::Enter,
              "Sets this isolate as the entered one for the current thread. "
              "Saves the previously entered one (if any), so that it can be "
@@ -18,10 +38,37 @@ void CManagedIsolate::Expose(void)
         .add_static_property("current", &CIsolateWrapper::GetCurrent,
                              "Returns the entered isolate for the current thread or NULL in case there is no current isolate.")
 
-        .def("GetCurrentStackTrace", &CIsolateWrapper::GetCurrentStackTrace);
+        .def("GetCurrentStackTrace", &CIsolateWrapper::GetCurrentStackTrace)
+
+        .def("heapStatistics", &CIsolateWrapper::GetHeapStatistics,
+             "Returns the statistics of the heap memory usage as a dict.")
+        .def("heapSpaceStatistics", &CIsolateWrapper::GetHeapSpaceStatistics,
+             "Returns the statistics of each heap space as a list of dict.")
+        .def("gcStatistics", &CIsolateWrapper::GetGCStatistics,
+             "Returns the count, total and max pause (in seconds) and the pause histogram of each GC type, "
+             "the histogram is a list of (upper bound in seconds, count).")
+        .def("resetGCStatistics", &CIsolateWrapper::ResetGCStatistics,
+             "Clears the collected GC statistics.")
+
+        .def("lockStatistics", &CIsolateWrapper::GetLockStatistics,
+             "Returns the threads waiting for this isolate, and the acquisitions, contentions, timeouts, "
+             "total and max wait (in seconds) of the JSLocker, in total and per priority lane.")
+
+        .add_property("microtaskPolicy", &CIsolateWrapper::GetMicrotasksPolicy, &CIsolateWrapper::SetMicrotasksPolicy,
+                      "When the queued microtasks (e.g. the Promise reactions) run, "
+                      "auto after the outermost call returns, scoped when the outermost script or function "
+                      "called from Python returns, or explicit by runMicrotasks().")
+        .def("runMicrotasks", &CIsolateWrapper::RunMicrotasks,
+             "Runs all the queued microtasks in one checkpoint.");
 
     py::class_<CManagedIsolate, py::bases<CIsolateWrapper>, boost::noncopyable>("JSManagedIsolate", py::no_init)
-        .def(py::init<>("Creates a new isolate.  Does not change the currently entered isolate."));
+        .def(py::init<py::object, size_t, size_t>((py::arg("snapshot") = py::object(),
+                                                   py::arg("max_old_space") = 0,
+                                                   py::arg("max_young_space") = 0),
+                                                  "Creates a new isolate, optional from a startup snapshot created by JSEngine.createSnapshot, "
+                                                  "with the heap limits of old and young generation in MB (0 means the V8 default). "
+                                                  "A script which exceeds the old space limit raises MemoryError. "
+                                                  "Does not change the currently entered isolate."));
 
     py::objects::class_value_wrapper<CIsolateWrapperPtr,
                                      py::objects::make_ptr_instance<CIsolateWrapper,
@@ -51,25 +98,283 @@ py::object CIsolateWrapper::GetCurrent(void)
                                          CIsolateWrapperPtr(new CIsolate(isolate)))));
 }
 
+py::dict CIsolateWrapper::GetLockStatistics(void)
+{
+    return CIsolateScheduler::Get(m_isolate)->GetStatistics();
+}
+
+void CIsolateWrapper::RunMicrotasks(void)
+{
+    v8::HandleScope handle_scope(m_isolate);
+
+    CHeapMonitor::Scope heap_scope(m_isolate);
+
+    {
+        // the microtasks may call back into Python
+        CAllowThreads allow_threads;
+
+        m_isolate->RunMicrotasks();
+    }
+
+    heap_scope.Check(false);
+}
+
+CHeapMonitor &CIsolateWrapper::HeapMonitor(void)
+{
+    // every isolate of PyV8 is a CManagedIsolate, the lazy creation only serves its constructors
+    auto monitor = GetData<CHeapMonitor>(DataSlots::HeapMonitorIndex, [this]() {
+        return new CHeapMonitor(m_isolate);
+    });
+
+    return *monitor;
+}
+
+py::dict CIsolateWrapper::GetHeapStatistics(void)
+{
+    v8::HeapStatistics stats;
+
+    m_isolate->GetHeapStatistics(&stats);
+
+    py::dict result;
+
+    result["total_heap_size"] = stats.total_heap_size();
+    result["total_heap_size_executable"] = stats.total_heap_size_executable();
+    result["total_physical_size"] = stats.total_physical_size();
+    result["total_available_size"] = stats.total_available_size();
+    result["used_heap_size"] = stats.used_heap_size();
+    result["heap_size_limit"] = stats.heap_size_limit();
+    result["malloced_memory"] = stats.malloced_memory();
+    result["peak_malloced_memory"] = stats.peak_malloced_memory();
+
+    return result;
+}
+
+py::list CIsolateWrapper::GetHeapSpaceStatistics(void)
+{
+    py::list result;
+
+    for (size_t i = 0; i < m_isolate->NumberOfHeapSpaces(); i++)
+    {
+        v8::HeapSpaceStatistics stats;
+
+        if (!m_isolate->GetHeapSpaceStatistics(&stats, i))
+            continue;
+
+        py::dict space;
+
+        space["space_name"] = stats.space_name();
+        space["space_size"] = stats.space_size();
+        space["space_used_size"] = stats.space_used_size();
+        space["space_available_size"] = stats.space_available_size();
+        space["physical_space_size"] = stats.physical_space_size();
+
+        result.append(space);
+    }
+
+    return result;
+}
+
+py::dict CIsolateWrapper::GetGCStatistics(void)
+{
+    CHeapMonitor &monitor = HeapMonitor();
+
+    py::dict result;
+
+    for (size_t i = 0; i < CHeapMonitor::GC_TYPES; i++)
+    {
+        const CHeapMonitor::GCStatistics &stats = monitor.GetGCStatistics(i);
+
+        py::list histogram;
+
+        for (size_t n = 0; n < CHeapMonitor::GC_BUCKETS; n++)
+        {
+            if (stats.histogram[n])
+                histogram.append(py::make_tuple((2 << n) / 1e6, stats.histogram[n]));
+        }
+
+        py::dict item;
+
+        item["count"] = stats.count;
+        item["total"] = stats.total.count() / 1e6;
+        item["max"] = stats.max.count() / 1e6;
+        item["histogram"] = histogram;
+
+        result[CHeapMonitor::GCTypeName(i)] = item;
+    }
+
+    return result;
+}
+
+void CIsolateWrapper::ResetGCStatistics(void)
+{
+    HeapMonitor().ResetGCStatistics();
+}
+
+CHeapMonitor::CHeapMonitor(v8::Isolate *isolate) : m_isolate(isolate), m_heap_limit(0), m_exhausted(false), m_depth(0)
+{
+    ResetGCStatistics();
+
+    m_isolate->AddGCPrologueCallback(OnGCPrologue);
+    m_isolate->AddGCEpilogueCallback(OnGCEpilogue);
+}
+
+CHeapMonitor::~CHeapMonitor()
+{
+    m_isolate->RemoveGCPrologueCallback(OnGCPrologue);
+    m_isolate->RemoveGCEpilogueCallback(OnGCEpilogue);
+}
+
+void CHeapMonitor::ResetGCStatistics(void)
+{
+    memset(m_gc_stats, 0, sizeof(m_gc_stats));
+}
+
+size_t CHeapMonitor::GCTypeIndex(v8::GCType type)
+{
+    switch (type)
+    {
+    case v8::kGCTypeScavenge:
+        return 0;
+    case v8::kGCTypeMarkSweepCompact:
+        return 1;
+    case v8::kGCTypeIncrementalMarking:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+const char *CHeapMonitor::GCTypeName(size_t index)
+{
+    static const char *names[GC_TYPES] = {"scavenge", "mark_sweep_compact", "incremental_marking", "process_weak_callbacks"};
+
+    return names[index];
+}
+
+void CHeapMonitor::OnGCPrologue(v8::Isolate *isolate, v8::GCType type, v8::GCCallbackFlags flags)
+{
+    CHeapMonitor *monitor = Find(isolate);
+
+    if (monitor)
+        monitor->m_gc_start[GCTypeIndex(type)] = std::chrono::steady_clock::now();
+}
+
+void CHeapMonitor::OnGCEpilogue(v8::Isolate *isolate, v8::GCType type, v8::GCCallbackFlags flags)
+{
+    CHeapMonitor *monitor = Find(isolate);
+
+    if (!monitor)
+        return;
+
+    size_t index = GCTypeIndex(type);
+    GCStatistics &gc = monitor->m_gc_stats[index];
+
+    auto pause = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - monitor->m_gc_start[index]);
+    size_t bucket = 0;
+
+    for (auto us = pause.count(); us > 1 && bucket < GC_BUCKETS - 1; us >>= 1)
+        bucket++;
+
+    gc.count++;
+    gc.total += pause;
+    gc.max = std::max(gc.max, pause);
+    gc.histogram[bucket]++;
+
+    if (!monitor->m_heap_limit || monitor->m_exhausted)
+        return;
+
+    v8::HeapStatistics stats;
+
+    isolate->GetHeapStatistics(&stats);
+
+    if (stats.used_heap_size() > monitor->m_heap_limit)
+    {
+        monitor->m_exhausted = true;
+
+        isolate->TerminateExecution();
+    }
+}
+
+void CHeapMonitor::Scope::Check(bool failed)
+{
+    if (!m_monitor || !m_monitor->m_exhausted)
+        return;
+
+    if (m_monitor->m_depth == 1)
+    {
+        m_monitor->m_exhausted = false;
+
+        m_isolate->CancelTerminateExecution();
+    }
+
+    if (failed)
+    {
+        std::ostringstream oss;
+
+        oss << "Javascript heap exceeded its limit of " << m_monitor->m_heap_limit / 1024 / 1024 << " MB";
+
+        throw CJavascriptException(oss.str(), ::PyExc_MemoryError);
+    }
+}
+
 CIsolate::CIsolate(v8::Isolate *isolate) : CIsolateWrapper(isolate)
 {
     BOOST_LOG_SEV(Logger(), trace) << "isolate wrapped";
 }
 
+CObjectTemplateCache &CIsolate::ObjectTemplateCache(void)
+{
+    auto cache = GetData<CObjectTemplateCache>(DataSlots::ObjectTemplateIndex, [this]() {
+        return new CObjectTemplateCache(m_isolate);
+    });
+
+    return *cache;
+}
+
 v8::Local<v8::ObjectTemplate> CIsolate::ObjectTemplate(void)
 {
-    auto object_template = GetData<v8::Persistent<v8::ObjectTemplate>>(DataSlots::ObjectTemplateIndex, [this]() {
-        v8::HandleScope handle_scope(m_isolate);
+    return ObjectTemplateCache().Generic();
+}
+
+v8::Local<v8::ObjectTemplate> CIsolate::ObjectTemplate(PyTypeObject *type)
+{
+    return ObjectTemplateCache().Get(type);
+}
+
+CPropertyNameCache &CIsolate::PropertyNames(void)
+{
+    return ObjectTemplateCache().PropertyNames();
+}
 
-        return new v8::Persistent<v8::ObjectTemplate>(m_isolate, CPythonObject::CreateObjectTemplate(m_isolate));
+CCompileCache &CIsolate::CompileCache(void)
+{
+    auto cache = GetData<CCompileCache>(DataSlots::CompileCacheIndex, [this]() {
+        return new CCompileCache(m_isolate);
     });
 
-    return object_template->Get(m_isolate);
+    return *cache;
 }
 
 CManagedIsolate::CManagedIsolate() : CIsolateWrapper(CreateIsolate())
 {
     BOOST_LOG_SEV(Logger(), trace) << "isolate created";
+
+    // created up front, the wrappers of the current isolate must never allocate one it doesn't free
+    HeapMonitor();
+}
+
+CManagedIsolate::CManagedIsolate(py::object snapshot, size_t max_old_space, size_t max_young_space)
+    : CManagedIsolate(CopySnapshot(snapshot), max_old_space, max_young_space)
+{
+}
+
+CManagedIsolate::CManagedIsolate(CStartupDataPtr snapshot, size_t max_old_space, size_t max_young_space)
+    : CIsolateWrapper(CreateIsolate(snapshot.get(), max_old_space, max_young_space)), m_snapshot(snapshot)
+{
+    BOOST_LOG_SEV(Logger(), trace) << "isolate created"
+                                   << (m_snapshot ? " from snapshot" : "");
+
+    HeapMonitor().SetHeapLimit(max_old_space * 1024 * 1024);
 }
 
 CManagedIsolate::~CManagedIsolate(void)
@@ -78,20 +383,84 @@ CManagedIsolate::~CManagedIsolate(void)
 
     ClearDataSlots();
 
+    CIsolateScheduler::Remove(m_isolate);
+
+    {
+        boost::mutex::scoped_lock lock(s_alive_lock);
+
+        s_alive.erase(m_isolate);
+    }
+
     m_isolate->Dispose();
 }
 
+bool CManagedIsolate::IsAlive(v8::Isolate *isolate)
+{
+    boost::mutex::scoped_lock lock(s_alive_lock);
+
+    return s_alive.find(isolate) != s_alive.end();
+}
+
 void CManagedIsolate::ClearDataSlots() const
 {
     delete GetData<logger_t>(DataSlots::LoggerIndex);
-    delete GetData<v8::Persistent<v8::ObjectTemplate>>(DataSlots::ObjectTemplateIndex);
+    delete GetData<CObjectTemplateCache>(DataSlots::ObjectTemplateIndex);
+    delete GetData<CCompileCache>(DataSlots::CompileCacheIndex);
+    delete GetData<CHeapMonitor>(DataSlots::HeapMonitorIndex);
 }
 
-v8::Isolate *CManagedIsolate::CreateIsolate()
+v8::Isolate *CManagedIsolate::CreateIsolate(const v8::StartupData *snapshot, size_t max_old_space, size_t max_young_space)
 {
     v8::Isolate::CreateParams params;
 
     params.array_buffer_allocator = v8::ArrayBuffer::Allocator::NewDefaultAllocator();
+    params.snapshot_blob = snapshot;
+
+    if (max_old_space)
+    {
+        // leave V8 some headroom to finish the GC in which CHeapMonitor terminates the script
+        params.constraints.set_max_old_space_size(static_cast<int>(max_old_space + std::max<size_t>(max_old_space / 4, 8)));
+    }
 
-    return v8::Isolate::New(params);
+    if (max_young_space)
+    {
+        // the young generation consists of two semi-spaces
+        params.constraints.set_max_semi_space_size(static_cast<int>(std::max<size_t>(max_young_space / 2, 1)));
+    }
+
+    v8::Isolate *isolate = v8::Isolate::New(params);
+
+    boost::mutex::scoped_lock lock(s_alive_lock);
+
+    s_alive.insert(isolate);
+
+    return isolate;
+}
+
+CStartupDataPtr CManagedIsolate::CopySnapshot(py::object snapshot)
+{
+    if (snapshot.is_none())
+        return CStartupDataPtr();
+
+    Py_buffer buf;
+
+    if (0 != ::PyObject_GetBuffer(snapshot.ptr(), &buf, PyBUF_SIMPLE))
+        py::throw_error_already_set();
+
+    CStartupDataPtr blob(new v8::StartupData(), ReleaseSnapshot);
+
+    blob->data = new char[buf.len];
+    blob->raw_size = static_cast<int>(buf.len);
+
+    memcpy(const_cast<char *>(blob->data), buf.buf, buf.len);
+
+    ::PyBuffer_Release(&buf);
+
+    return blob;
+}
+
+void CManagedIsolate::ReleaseSnapshot(v8::StartupData *snapshot)
+{
+    delete[] snapshot->data;
+    delete snapshot;
 }
@@ -1,12 +1,18 @@
 #pragma once
 
+#include <set>
+#include <chrono>
 #include <functional>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "Wrapper.h"
 #include "Utils.h"
 
+class CCompileCache;
+class CHeapMonitor;
+
 class CIsolateBase
 {
 protected:
@@ -23,9 +29,13 @@ protected: // Data Slots
   enum DataSlots
   {
     LoggerIndex,
-    ObjectTemplateIndex
+    ObjectTemplateIndex,
+    CompileCacheIndex,
+    HeapMonitorIndex
   };
 
+  friend class CHeapMonitor;
+
   template <typename T>
   inline T *GetData(DataSlots slot, std::function<T *()> creator = nullptr) const
   {
@@ -58,11 +68,36 @@ class CIsolateWrapper : public CIsolateBase
 protected:
   CIsolateWrapper(v8::Isolate *isolate) : CIsolateBase(isolate) {}
 
+public: // Operators
+  inline bool Equals(const CIsolateWrapper &other) const { return m_isolate == other.m_isolate; }
+  inline bool Unequals(const CIsolateWrapper &other) const { return m_isolate != other.m_isolate; }
+  inline size_t Hash(void) const { return std::hash<v8::Isolate *>()(m_isolate); }
+
 public: // Properties
   inline bool IsLocked(void) const { return v8::Locker::IsLocked(m_isolate); }
 
   inline bool InUse(void) const { return m_isolate->IsInUse(); }
 
+public: // Internal Properties
+  // owned by the CManagedIsolate, which creates it with the isolate and frees it in ClearDataSlots,
+  // so the other wrappers of the isolate (e.g. JSIsolate.current) only look it up
+  CHeapMonitor &HeapMonitor(void);
+
+public: // Heap Statistics
+  py::dict GetHeapStatistics(void);
+  py::list GetHeapSpaceStatistics(void);
+  py::dict GetGCStatistics(void);
+  void ResetGCStatistics(void);
+
+public: // Scheduler Statistics
+  py::dict GetLockStatistics(void);
+
+public: // Microtasks
+  v8::MicrotasksPolicy GetMicrotasksPolicy(void) const { return m_isolate->GetMicrotasksPolicy(); }
+  void SetMicrotasksPolicy(v8::MicrotasksPolicy policy) { m_isolate->SetMicrotasksPolicy(policy); }
+
+  void RunMicrotasks(void);
+
 public: // Methods
   void Enter(void)
   {
@@ -104,19 +139,123 @@ public:
 public: // Internal Properties
   static CIsolate Current(void) { return CIsolate(v8::Isolate::GetCurrent()); }
 
+  CObjectTemplateCache &ObjectTemplateCache(void);
+
   v8::Local<v8::ObjectTemplate> ObjectTemplate(void);
+  v8::Local<v8::ObjectTemplate> ObjectTemplate(PyTypeObject *type);
+
+  CPropertyNameCache &PropertyNames(void);
+
+  CCompileCache &CompileCache(void);
+};
+
+//
+// Per-isolate heap guard and GC telemetry, kept in the HeapMonitorIndex data slot.
+//
+// V8 is configured with some headroom above the heap limit, and the GC epilogue terminates the running
+// script once the live heap grows beyond the limit, so the caller gets a MemoryError instead of a fatal OOM.
+//
+// The GC pauses are aggregated per GC type into log2 histograms, no Python code runs during a GC.
+//
+class CHeapMonitor : private boost::noncopyable
+{
+public:
+  static const size_t GC_TYPES = 4;      // scavenge, mark-sweep-compact, incremental marking, weak callbacks
+  static const size_t GC_BUCKETS = 24;   // bucket N counts the pauses shorter than 2^(N+1) microseconds
+
+  struct GCStatistics
+  {
+    size_t count;
+    std::chrono::microseconds total, max;
+    size_t histogram[GC_BUCKETS];
+  };
+
+private:
+  v8::Isolate *m_isolate;
+  size_t m_heap_limit;
+  bool m_exhausted;
+  size_t m_depth;
+
+  GCStatistics m_gc_stats[GC_TYPES];
+  std::chrono::steady_clock::time_point m_gc_start[GC_TYPES];
+
+  static size_t GCTypeIndex(v8::GCType type);
+
+  static void OnGCPrologue(v8::Isolate *isolate, v8::GCType type, v8::GCCallbackFlags flags);
+  static void OnGCEpilogue(v8::Isolate *isolate, v8::GCType type, v8::GCCallbackFlags flags);
+
+public:
+  CHeapMonitor(v8::Isolate *isolate);
+  ~CHeapMonitor();
+
+  // the monitor of isolate, or NULL if it has never been created
+  static CHeapMonitor *Find(v8::Isolate *isolate)
+  {
+    return static_cast<CHeapMonitor *>(isolate->GetData(CIsolateBase::HeapMonitorIndex));
+  }
+
+  size_t GetHeapLimit(void) const { return m_heap_limit; }
+  void SetHeapLimit(size_t limit) { m_heap_limit = limit; }
+
+  static const char *GCTypeName(size_t index);
+
+  const GCStatistics &GetGCStatistics(size_t index) const { return m_gc_stats[index]; }
+  void ResetGCStatistics(void);
+
+  //
+  // Guards a call from Python into Javascript.
+  //
+  // The termination caused by the heap limit is only cancelled (and the guard rearmed) when the outermost call returns,
+  // the nested calls just raise MemoryError, so the termination keeps unwinding the Javascript stack below them.
+  //
+  class Scope
+  {
+    v8::Isolate *m_isolate;
+    CHeapMonitor *m_monitor;
+
+  public:
+    Scope(v8::Isolate *isolate) : m_isolate(isolate), m_monitor(Find(isolate))
+    {
+      if (m_monitor) m_monitor->m_depth++;
+    }
+    ~Scope()
+    {
+      if (m_monitor) m_monitor->m_depth--;
+    }
+
+    // raises MemoryError if the call failed because the heap limit terminated it
+    void Check(bool failed);
+  };
 };
 
+typedef boost::shared_ptr<v8::StartupData> CStartupDataPtr;
+
 class CManagedIsolate : public CIsolateWrapper, private boost::noncopyable
 {
-  static v8::Isolate *CreateIsolate();
+  // V8 keeps referring to the startup blob when creating contexts, so it must outlive the isolate
+  CStartupDataPtr m_snapshot;
+
+  static boost::mutex s_alive_lock;
+  static std::set<v8::Isolate *> s_alive;
+
+  static v8::Isolate *CreateIsolate(const v8::StartupData *snapshot = NULL,
+                                    size_t max_old_space = 0, size_t max_young_space = 0);
+
+  static CStartupDataPtr CopySnapshot(py::object snapshot);
+  static void ReleaseSnapshot(v8::StartupData *snapshot);
+
+  CManagedIsolate(CStartupDataPtr snapshot, size_t max_old_space, size_t max_young_space);
 
   void ClearDataSlots() const;
 
 public:
   CManagedIsolate();
+  CManagedIsolate(py::object snapshot, size_t max_old_space = 0, size_t max_young_space = 0);
   virtual ~CManagedIsolate(void);
 
+  // the objects which outlive their isolate (e.g. a JSError read by another thread) must check it first
+  static bool IsAlive(v8::Isolate *isolate);
+
   static void Expose(void);
 };
 
@@ -1,14 +1,24 @@
 #include "Locker.h"
 
 #include "V8Internal.h"
+#include "Watchdog.h"
+
+namespace chr = boost::chrono;
 
 bool CLocker::s_preemption = false;
 
+CIsolateScheduler::lock_t CIsolateScheduler::s_lock;
+std::map<v8::Isolate *, CIsolateSchedulerPtr> CIsolateScheduler::s_schedulers;
+
 void CLocker::Expose(void)
 {
   py::class_<CLocker, boost::noncopyable>("JSLocker", py::no_init)
-      .def(py::init<>())
-      .def(py::init<CIsolateWrapperPtr>((py::arg("isolate"))))
+      .def(py::init<py::object, int, double>((py::arg("isolate") = py::object(),
+                                              py::arg("priority") = 0,
+                                              py::arg("timeout") = -1.0),
+                                             "Lock the isolate (or the current one) for the current thread. "
+                                             "The waiting threads are served by priority, then in the arrival order; "
+                                             "enter raises JSTimeoutError if the timeout (in seconds) elapses first."))
 
       .add_static_property("active", &v8::Locker::IsActive,
                            "whether Locker is being used by this V8 instance.")
@@ -28,19 +38,45 @@ void CLocker::Expose(void)
       .def("leave", &CUnlocker::leave);
 }
 
+CLocker::CLocker(py::object isolate, int priority, double timeout)
+    : m_isolate(isolate.is_none() ? CIsolateWrapperPtr(new CIsolate(v8::Isolate::GetCurrent()))
+                                  : py::extract<CIsolateWrapperPtr>(isolate)()),
+      m_priority(priority), m_timeout(timeout)
+{
+}
+
 void CLocker::enter(void)
 {
+  if (m_locker.get())
+    return;
+
+  v8::Isolate *isolate = m_isolate->GetIsolate();
+
+  m_scheduler = CIsolateScheduler::Get(isolate);
+
+  bool acquired;
+
   Py_BEGIN_ALLOW_THREADS
 
-      m_locker.reset(new v8::Locker(m_isolate->GetIsolate()));
+  acquired = m_scheduler->Acquire(m_priority, m_timeout);
+
+  if (acquired)
+    m_locker.reset(new v8::Locker(isolate));
 
   Py_END_ALLOW_THREADS
+
+  if (!acquired)
+    throw CJavascriptException("timed out waiting for the isolate", CWatchdog::TimeoutError());
 }
 void CLocker::leave(void)
 {
+  if (!m_locker.get())
+    return;
+
   Py_BEGIN_ALLOW_THREADS
 
-      m_locker.reset();
+  m_locker.reset();
+  m_scheduler->Release();
 
   Py_END_ALLOW_THREADS
 }
@@ -49,3 +85,217 @@ bool CLocker::IsLocked()
 {
   return v8::Locker::IsLocked(m_isolate->GetIsolate());
 }
+
+void CUnlocker::enter(void)
+{
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  if (m_unlocker.get() || !v8::Locker::IsLocked(isolate))
+    return;
+
+  m_scheduler = CIsolateScheduler::Get(isolate);
+
+  Py_BEGIN_ALLOW_THREADS
+
+  m_unlocker.reset(new v8::Unlocker(isolate));
+
+  m_depth = m_scheduler->Suspend(m_priority);
+
+  Py_END_ALLOW_THREADS
+}
+void CUnlocker::leave(void)
+{
+  if (!m_unlocker.get())
+    return;
+
+  Py_BEGIN_ALLOW_THREADS
+
+  m_scheduler->Resume(m_depth, m_priority);
+
+  m_unlocker.reset();
+
+  Py_END_ALLOW_THREADS
+}
+
+CIsolateSchedulerPtr CIsolateScheduler::Get(v8::Isolate *isolate)
+{
+  lock_guard_t lock(s_lock);
+
+  CIsolateSchedulerPtr &scheduler = s_schedulers[isolate];
+
+  if (!scheduler)
+    scheduler.reset(new CIsolateScheduler());
+
+  return scheduler;
+}
+
+void CIsolateScheduler::Remove(v8::Isolate *isolate)
+{
+  lock_guard_t lock(s_lock);
+
+  s_schedulers.erase(isolate);
+}
+
+bool CIsolateScheduler::Acquire(int priority, double timeout)
+{
+  lock_guard_t lock(m_lock);
+
+  boost::thread::id current = boost::this_thread::get_id();
+
+  if (m_owner == current)
+  {
+    m_depth++;
+
+    return true;
+  }
+
+  Waiter waiter = {priority, m_next_ticket++};
+
+  m_waiters.insert(waiter);
+
+  LaneStatistics &lane = m_lanes[priority];
+
+  chr::steady_clock::time_point start = chr::steady_clock::now();
+
+  if (!IsAvailable(waiter))
+  {
+    lane.contended++;
+
+    chr::steady_clock::time_point deadline = start + chr::microseconds(static_cast<int64_t>(timeout * 1000000));
+
+    while (!IsAvailable(waiter))
+    {
+      if (timeout < 0)
+      {
+        m_cond.wait(lock);
+      }
+      else if (m_cond.wait_until(lock, deadline) == boost::cv_status::timeout && !IsAvailable(waiter))
+      {
+        m_waiters.erase(waiter);
+
+        lane.timeouts++;
+
+        // the waiters behind may be served now
+        m_cond.notify_all();
+
+        return false;
+      }
+    }
+  }
+
+  m_waiters.erase(waiter);
+
+  m_owner = current;
+  m_depth = 1;
+  m_priority = priority;
+
+  chr::nanoseconds wait = chr::steady_clock::now() - start;
+
+  lane.acquisitions++;
+  lane.wait += wait;
+
+  if (wait > lane.max_wait)
+    lane.max_wait = wait;
+
+  return true;
+}
+
+void CIsolateScheduler::Release(void)
+{
+  lock_guard_t lock(m_lock);
+
+  if (m_owner != boost::this_thread::get_id())
+    return;
+
+  if (--m_depth == 0)
+  {
+    m_owner = boost::thread::id();
+
+    m_cond.notify_all();
+  }
+}
+
+size_t CIsolateScheduler::Suspend(int &priority)
+{
+  lock_guard_t lock(m_lock);
+
+  if (m_owner != boost::this_thread::get_id())
+    return 0;
+
+  size_t depth = m_depth;
+
+  priority = m_priority;
+
+  m_owner = boost::thread::id();
+  m_depth = 0;
+
+  m_cond.notify_all();
+
+  return depth;
+}
+
+void CIsolateScheduler::Resume(size_t depth, int priority)
+{
+  if (!depth)
+    return;
+
+  Acquire(priority, -1);
+
+  lock_guard_t lock(m_lock);
+
+  m_depth = depth;
+}
+
+py::dict CIsolateScheduler::GetStatistics(void)
+{
+  std::map<int, LaneStatistics> lanes;
+  size_t waiting;
+  bool locked;
+
+  {
+    lock_guard_t lock(m_lock);
+
+    lanes = m_lanes;
+    waiting = m_waiters.size();
+    locked = m_owner != boost::thread::id();
+  }
+
+  py::dict result, lanes_stats;
+
+  size_t acquisitions = 0, contended = 0, timeouts = 0;
+  chr::nanoseconds wait = chr::nanoseconds::zero(), max_wait = chr::nanoseconds::zero();
+
+  for (auto &it : lanes)
+  {
+    const LaneStatistics &lane = it.second;
+
+    py::dict stats;
+
+    stats["acquisitions"] = lane.acquisitions;
+    stats["contended"] = lane.contended;
+    stats["timeouts"] = lane.timeouts;
+    stats["wait"] = chr::duration<double>(lane.wait).count();
+    stats["max_wait"] = chr::duration<double>(lane.max_wait).count();
+
+    lanes_stats[it.first] = stats;
+
+    acquisitions += lane.acquisitions;
+    contended += lane.contended;
+    timeouts += lane.timeouts;
+    wait += lane.wait;
+
+    if (lane.max_wait > max_wait)
+      max_wait = lane.max_wait;
+  }
+
+  result["locked"] = locked;
+  result["waiting"] = waiting;
+  result["acquisitions"] = acquisitions;
+  result["contended"] = contended;
+  result["timeouts"] = timeouts;
+  result["wait"] = chr::duration<double>(wait).count();
+  result["max_wait"] = chr::duration<double>(max_wait).count();
+  result["lanes"] = lanes_stats;
+
+  return result;
+}
@@ -1,21 +1,113 @@
 #pragma once
 
+#include <map>
+#include <set>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/chrono.hpp>
+
 #include "Exception.h"
 #include "Isolate.h"
 #include "Utils.h"
 
+//
+// Fair scheduler of the threads waiting for an isolate, one per isolate.
+//
+// The waiters are served by priority, then in the arrival order, instead of racing on the V8 lock,
+// which lets a long running thread starve the others. The owner thread may acquire it again,
+// and hands it to the next waiter when it suspends itself with a JSUnlocker.
+//
+class CIsolateScheduler : private boost::noncopyable
+{
+  typedef boost::mutex lock_t;
+  typedef boost::unique_lock<lock_t> lock_guard_t;
+
+  struct Waiter
+  {
+    int priority;
+    uint64_t ticket;
+
+    bool operator<(const Waiter &other) const
+    {
+      return priority > other.priority || (priority == other.priority && ticket < other.ticket);
+    }
+  };
+
+  struct LaneStatistics
+  {
+    size_t acquisitions, contended, timeouts;
+    boost::chrono::nanoseconds wait, max_wait; // measured on the monotonic clock
+
+    LaneStatistics()
+        : acquisitions(0), contended(0), timeouts(0),
+          wait(boost::chrono::nanoseconds::zero()), max_wait(boost::chrono::nanoseconds::zero()) {}
+  };
+
+  lock_t m_lock;
+  boost::condition_variable m_cond;
+
+  std::set<Waiter> m_waiters;
+  uint64_t m_next_ticket;
+
+  boost::thread::id m_owner;
+  size_t m_depth;
+  int m_priority;
+
+  std::map<int, LaneStatistics> m_lanes;
+
+  static lock_t s_lock;
+  static std::map<v8::Isolate *, boost::shared_ptr<CIsolateScheduler>> s_schedulers;
+
+  bool IsAvailable(const Waiter &waiter) const
+  {
+    return m_owner == boost::thread::id() && m_waiters.begin()->ticket == waiter.ticket;
+  }
+
+public:
+  CIsolateScheduler() : m_next_ticket(0), m_depth(0), m_priority(0) {}
+
+  static boost::shared_ptr<CIsolateScheduler> Get(v8::Isolate *isolate);
+  static void Remove(v8::Isolate *isolate);
+
+  // wait (for at most timeout seconds unless it's negative) until the isolate is available to the current thread
+  bool Acquire(int priority, double timeout);
+  void Release(void);
+
+  // hand the isolate owned by the current thread to the next waiter, returns the depth to resume with
+  size_t Suspend(int &priority);
+  void Resume(size_t depth, int priority);
+
+  py::dict GetStatistics(void);
+};
+
+typedef boost::shared_ptr<CIsolateScheduler> CIsolateSchedulerPtr;
+
 class CLocker
 {
   static bool s_preemption;
 
   std::auto_ptr<v8::Locker> m_locker;
   CIsolateWrapperPtr m_isolate;
+  CIsolateSchedulerPtr m_scheduler;
+
+  int m_priority;
+  double m_timeout;
 
 public:
-  CLocker() : m_isolate(new CIsolate(v8::Isolate::GetCurrent())) {}
-  CLocker(CIsolateWrapperPtr isolate) : m_isolate(isolate)
+  CLocker() : m_isolate(new CIsolate(v8::Isolate::GetCurrent())), m_priority(0), m_timeout(-1) {}
+  CLocker(CIsolateWrapperPtr isolate, int priority = 0, double timeout = -1)
+      : m_isolate(isolate), m_priority(priority), m_timeout(timeout)
   {
   }
+  CLocker(py::object isolate, int priority, double timeout);
+
+  // a locker dropped while entered must hand the isolate to the waiters, the GIL is released meanwhile
+  ~CLocker() { leave(); }
+
   bool entered(void) { return NULL != m_locker.get(); }
 
   void enter(void);
@@ -29,24 +121,17 @@ public:
 class CUnlocker
 {
   std::auto_ptr<v8::Unlocker> m_unlocker;
+  CIsolateSchedulerPtr m_scheduler;
+  size_t m_depth;
+  int m_priority;
 
 public:
-  bool entered(void) { return NULL != m_unlocker.get(); }
+  CUnlocker() : m_depth(0), m_priority(0) {}
 
-  void enter(void)
-  {
-    Py_BEGIN_ALLOW_THREADS
-
-        m_unlocker.reset(new v8::Unlocker(v8::Isolate::GetCurrent()));
-
-    Py_END_ALLOW_THREADS
-  }
-  void leave(void)
-  {
-    Py_BEGIN_ALLOW_THREADS
+  ~CUnlocker() { leave(); }
 
-        m_unlocker.reset();
+  bool entered(void) { return NULL != m_unlocker.get(); }
 
-    Py_END_ALLOW_THREADS
-  }
+  void enter(void);
+  void leave(void);
 };
@@ -0,0 +1,338 @@
+#include "Profiler.h"
+
+#include <vector>
+
+void CProfiler::Expose(void)
+{
+  py::class_<CProfiler, boost::noncopyable>("JSProfiler", "JSProfiler samples the Javascript call stacks of an isolate.", py::no_init)
+      .def(py::init<int>((py::arg("interval") = 1000),
+                         "create a profiler of the current isolate with the sampling interval in microseconds"))
+      .def(py::init<CIsolateWrapperPtr, int>((py::arg("isolate"),
+                                              py::arg("interval") = 1000),
+                                             "create a profiler of the isolate with the sampling interval in microseconds"))
+
+      .add_property("interval", &CProfiler::GetInterval, &CProfiler::SetInterval,
+                    "The sampling interval in microseconds, may only be changed before starting.")
+      .add_property("profiling", &CProfiler::IsProfiling, "Whether the profiler has been started.")
+
+      .def("start", &CProfiler::Start, (py::arg("title") = std::string(),
+                                        py::arg("record_samples") = true),
+           "Start collecting the CPU profile.")
+      .def("stop", &CProfiler::Stop,
+           "Stop collecting and return the profile in the .cpuprofile layout.");
+
+  py::class_<CHeapProfiler, boost::noncopyable>("JSHeapProfiler", "JSHeapProfiler inspects the Javascript heap of an isolate.", py::no_init)
+      .def(py::init<>("create a heap profiler of the current isolate"))
+      .def(py::init<CIsolateWrapperPtr>((py::arg("isolate")),
+                                        "create a heap profiler of the isolate"))
+
+      .add_property("sampling", &CHeapProfiler::IsSampling, "Whether the sampling heap profiler has been started.")
+
+      .def("takeSnapshot", &CHeapProfiler::TakeSnapshot, (py::arg("file")),
+           "Take a heap snapshot and write it to the file object in the .heapsnapshot format.")
+
+      .def("startSampling", &CHeapProfiler::StartSampling, (py::arg("interval") = 512 * 1024,
+                                                            py::arg("depth") = 16),
+           "Start sampling the allocations with the average interval in bytes and the max depth of stacks.")
+      .def("stopSampling", &CHeapProfiler::StopSampling,
+           "Stop sampling and return the tree of allocation stacks.");
+}
+
+CProfiler::~CProfiler()
+{
+  if (m_profiling)
+  {
+    CDisposeLocker locker(m_isolate->GetIsolate());
+
+    v8::HandleScope handle_scope(m_isolate->GetIsolate());
+
+    v8::CpuProfile *profile = Profiler()->StopProfiling(ToString(m_title, m_isolate->GetIsolate()));
+
+    if (profile) profile->Delete();
+  }
+}
+
+void CProfiler::SetInterval(int interval)
+{
+  if (m_profiling)
+    throw CJavascriptException("can't change the sampling interval while profiling", ::PyExc_RuntimeError);
+
+  if (interval <= 0)
+    throw CJavascriptException("sampling interval must be positive", ::PyExc_ValueError);
+
+  m_interval = interval;
+}
+
+void CProfiler::Start(const std::string &title, bool record_samples)
+{
+  if (m_profiling)
+    throw CJavascriptException("profiler has been started", ::PyExc_RuntimeError);
+
+  v8::HandleScope handle_scope(m_isolate->GetIsolate());
+
+  Profiler()->SetSamplingInterval(m_interval);
+  Profiler()->StartProfiling(ToString(title, m_isolate->GetIsolate()), record_samples);
+
+  m_title = title;
+  m_profiling = true;
+}
+
+py::object CProfiler::Stop(void)
+{
+  if (!m_profiling)
+    throw CJavascriptException("profiler has not been started", ::PyExc_RuntimeError);
+
+  m_profiling = false;
+
+  v8::HandleScope handle_scope(m_isolate->GetIsolate());
+
+  v8::CpuProfile *profile = Profiler()->StopProfiling(ToString(m_title, m_isolate->GetIsolate()));
+
+  if (!profile) return py::object();
+
+  py::object result = ToPython(profile);
+
+  profile->Delete();
+
+  return result;
+}
+
+static py::str ToPythonStr(v8::Handle<v8::String> str)
+{
+  v8::String::Utf8Value value(str);
+
+  return py::str(*value, value.length());
+}
+
+// streams the serialized heap snapshot to the write method of a Python file object
+class CPythonOutputStream : public v8::OutputStream
+{
+  py::object m_file;
+  bool m_failed;
+
+public:
+  CPythonOutputStream(py::object file) : m_file(file), m_failed(false) {}
+
+  bool IsFailed(void) const { return m_failed; }
+
+  virtual int GetChunkSize(void) { return 64 * 1024; }
+
+  virtual void EndOfStream(void) {}
+
+  virtual WriteResult WriteAsciiChunk(char *data, int size)
+  {
+    // pass a bytes object, "s#" would need PY_SSIZE_T_CLEAN on Python 3.10+ and write str to a binary file
+    PyObject *chunk = ::PyBytes_FromStringAndSize(data, size);
+
+    PyObject *result = chunk ? ::PyObject_CallMethod(m_file.ptr(), const_cast<char *>("write"), const_cast<char *>("O"), chunk) : NULL;
+
+    Py_XDECREF(chunk);
+
+    if (!result)
+    {
+      m_failed = true;
+
+      return kAbort;
+    }
+
+    Py_DECREF(result);
+
+    return kContinue;
+  }
+};
+
+// labels a wrapped Python object in the heap snapshot with its type name
+class CPythonObjectInfo : public v8::RetainedObjectInfo
+{
+  PyObject *m_obj;
+
+public:
+  CPythonObjectInfo(PyObject *obj) : m_obj(obj) {}
+
+  virtual void Dispose(void) { delete this; }
+
+  virtual bool IsEquivalent(v8::RetainedObjectInfo *other) { return GetHash() == other->GetHash(); }
+
+  virtual intptr_t GetHash(void) { return reinterpret_cast<intptr_t>(m_obj); }
+
+  virtual const char *GetLabel(void) { return Py_TYPE(m_obj)->tp_name; }
+
+  virtual intptr_t GetSizeInBytes(void) { return Py_TYPE(m_obj)->tp_basicsize; }
+};
+
+void CHeapProfiler::Init(void)
+{
+  Profiler()->SetWrapperClassInfoProvider(CPythonObject::WRAPPER_CLASS_ID, GetWrapperInfo);
+}
+
+CHeapProfiler::~CHeapProfiler()
+{
+  if (m_sampling)
+  {
+    CDisposeLocker locker(m_isolate->GetIsolate());
+
+    Profiler()->StopSamplingHeapProfiler();
+  }
+}
+
+v8::RetainedObjectInfo *CHeapProfiler::GetWrapperInfo(uint16_t class_id, v8::Local<v8::Value> wrapper)
+{
+  if (class_id != CPythonObject::WRAPPER_CLASS_ID || !wrapper->IsObject())
+    return NULL;
+
+  v8::Local<v8::Object> obj = wrapper.As<v8::Object>();
+
+  if (obj->InternalFieldCount() < 1)
+    return NULL;
+
+  v8::Local<v8::Value> field = obj->GetInternalField(0);
+
+  if (!field->IsExternal())
+    return NULL;
+
+  py::object *object = static_cast<py::object *>(field.As<v8::External>()->Value());
+
+  return new CPythonObjectInfo(object->ptr());
+}
+
+void CHeapProfiler::TakeSnapshot(py::object file)
+{
+  v8::HandleScope handle_scope(m_isolate->GetIsolate());
+
+  const v8::HeapSnapshot *snapshot = Profiler()->TakeHeapSnapshot();
+
+  if (!snapshot)
+    throw CJavascriptException("fail to take heap snapshot", ::PyExc_RuntimeError);
+
+  CPythonOutputStream stream(file);
+
+  snapshot->Serialize(&stream, v8::HeapSnapshot::kJSON);
+
+  const_cast<v8::HeapSnapshot *>(snapshot)->Delete();
+
+  if (stream.IsFailed()) py::throw_error_already_set();
+}
+
+void CHeapProfiler::StartSampling(uint64_t interval, int depth)
+{
+  if (m_sampling)
+    throw CJavascriptException("sampling heap profiler has been started", ::PyExc_RuntimeError);
+
+  if (!Profiler()->StartSamplingHeapProfiler(interval, depth))
+    throw CJavascriptException("fail to start sampling heap profiler", ::PyExc_RuntimeError);
+
+  m_sampling = true;
+}
+
+py::object CHeapProfiler::StopSampling(void)
+{
+  if (!m_sampling)
+    throw CJavascriptException("sampling heap profiler has not been started", ::PyExc_RuntimeError);
+
+  v8::HandleScope handle_scope(m_isolate->GetIsolate());
+
+  std::auto_ptr<v8::AllocationProfile> profile(Profiler()->GetAllocationProfile());
+
+  Profiler()->StopSamplingHeapProfiler();
+
+  m_sampling = false;
+
+  return profile.get() ? ToPython(profile->GetRootNode()) : py::object();
+}
+
+py::object CHeapProfiler::ToPython(const v8::AllocationProfile::Node *node)
+{
+  py::list allocations, children;
+
+  for (std::vector<v8::AllocationProfile::Allocation>::const_iterator it = node->allocations.begin(); it != node->allocations.end(); ++it)
+  {
+    allocations.append(py::make_tuple(it->size, it->count));
+  }
+
+  for (std::vector<v8::AllocationProfile::Node *>::const_iterator it = node->children.begin(); it != node->children.end(); ++it)
+  {
+    children.append(ToPython(*it));
+  }
+
+  py::dict result;
+
+  result["name"] = ToPythonStr(node->name);
+  result["script"] = ToPythonStr(node->script_name);
+  result["line"] = node->line_number;
+  result["column"] = node->column_number;
+  result["allocations"] = allocations;
+  result["children"] = children;
+
+  return result;
+}
+
+py::object CProfiler::ToPython(v8::CpuProfile *profile)
+{
+  py::list nodes;
+
+  std::vector<const v8::CpuProfileNode *> pending(1, profile->GetTopDownRoot());
+
+  while (!pending.empty())
+  {
+    const v8::CpuProfileNode *node = pending.back();
+
+    pending.pop_back();
+
+    py::dict frame;
+
+    frame["functionName"] = ToPythonStr(node->GetFunctionName());
+    frame["scriptId"] = py::str(py::object(node->GetScriptId()));
+    frame["url"] = ToPythonStr(node->GetScriptResourceName());
+    // .cpuprofile positions are zero based
+    frame["lineNumber"] = node->GetLineNumber() - 1;
+    frame["columnNumber"] = node->GetColumnNumber() - 1;
+
+    py::list children;
+
+    for (int i = 0; i < node->GetChildrenCount(); i++)
+    {
+      const v8::CpuProfileNode *child = node->GetChild(i);
+
+      children.append(child->GetNodeId());
+      pending.push_back(child);
+    }
+
+    py::dict item;
+
+    item["id"] = node->GetNodeId();
+    item["callFrame"] = frame;
+    item["hitCount"] = node->GetHitCount();
+    item["children"] = children;
+
+    const char *reason = node->GetBailoutReason();
+
+    if (reason && *reason) item["bailoutReason"] = reason;
+
+    nodes.append(item);
+  }
+
+  py::list samples, deltas;
+
+  int64_t last = profile->GetStartTime();
+
+  for (int i = 0; i < profile->GetSamplesCount(); i++)
+  {
+    int64_t timestamp = profile->GetSampleTimestamp(i);
+
+    samples.append(profile->GetSample(i)->GetNodeId());
+    deltas.append(timestamp - last);
+
+    last = timestamp;
+  }
+
+  py::dict result;
+
+  result["title"] = ToPythonStr(profile->GetTitle());
+  result["nodes"] = nodes;
+  result["startTime"] = profile->GetStartTime();
+  result["endTime"] = profile->GetEndTime();
+  result["samples"] = samples;
+  result["timeDeltas"] = deltas;
+
+  return result;
+}
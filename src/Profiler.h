@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <v8-profiler.h>
+
+#include "Isolate.h"
+
+//
+// The sampling CPU profiler of an isolate.
+//
+// A stopped profile is converted to Python in one pass, using the layout of the .cpuprofile format of
+// Chrome DevTools: a flat list of nodes which refer to their children by id, plus the samples and time deltas.
+//
+class CProfiler : private boost::noncopyable
+{
+  CIsolateWrapperPtr m_isolate;
+  int m_interval;
+  std::string m_title;
+  bool m_profiling;
+
+  v8::CpuProfiler *Profiler(void) { return m_isolate->GetIsolate()->GetCpuProfiler(); }
+
+  static py::object ToPython(v8::CpuProfile *profile);
+
+public:
+  CProfiler(int interval = 1000)
+      : m_isolate(new CIsolate(v8::Isolate::GetCurrent())), m_interval(interval), m_profiling(false)
+  {
+  }
+  CProfiler(CIsolateWrapperPtr isolate, int interval = 1000)
+      : m_isolate(isolate), m_interval(interval), m_profiling(false)
+  {
+  }
+  ~CProfiler();
+
+  int GetInterval(void) const { return m_interval; }
+  void SetInterval(int interval);
+
+  bool IsProfiling(void) const { return m_profiling; }
+
+  void Start(const std::string &title, bool record_samples);
+  py::object Stop(void);
+
+  static void Expose(void);
+};
+
+//
+// The heap profiler of an isolate, which streams the heap snapshots to a Python file object
+// and collects the allocation profile of the sampling heap profiler.
+//
+class CHeapProfiler : private boost::noncopyable
+{
+  CIsolateWrapperPtr m_isolate;
+  bool m_sampling;
+
+  v8::HeapProfiler *Profiler(void) { return m_isolate->GetIsolate()->GetHeapProfiler(); }
+
+  void Init(void);
+
+  static v8::RetainedObjectInfo *GetWrapperInfo(uint16_t class_id, v8::Local<v8::Value> wrapper);
+
+  static py::object ToPython(const v8::AllocationProfile::Node *node);
+
+public:
+  CHeapProfiler() : m_isolate(new CIsolate(v8::Isolate::GetCurrent())), m_sampling(false) { Init(); }
+  CHeapProfiler(CIsolateWrapperPtr isolate) : m_isolate(isolate), m_sampling(false) { Init(); }
+  ~CHeapProfiler();
+
+  void TakeSnapshot(py::object file);
+
+  bool IsSampling(void) const { return m_sampling; }
+
+  void StartSampling(uint64_t interval, int depth);
+  py::object StopSampling(void);
+
+  static void Expose(void);
+};
@@ -15,6 +15,8 @@ namespace fs = boost::filesystem;
 #include "Config.h"
 #include "Engine.h"
 #include "Locker.h"
+#include "Watchdog.h"
+#include "Profiler.h"
 #include "Utils.h"
 
 #ifdef SUPPORT_DEBUGGER
@@ -82,6 +84,8 @@ BOOST_PYTHON_MODULE(_PyV8)
   CContext::Expose();
   CEngine::Expose();
   CLocker::Expose();
+  CWatchdog::Expose();
+  CProfiler::Expose();
 
 #ifdef SUPPORT_DEBUGGER
   CDebug::Expose();
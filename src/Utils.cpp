@@ -7,8 +7,11 @@
 #include <vector>
 #include <iterator>
 
+#include <boost/thread/mutex.hpp>
+
 #include "utf8.h"
 #include "Locker.h"
+#include "Watchdog.h"
 #include "V8Internal.h"
 
 v8::Handle<v8::String> ToString(const std::string& str, v8::Isolate *isolate)
@@ -29,42 +32,196 @@ v8::Handle<v8::String> ToString(const std::wstring& str, v8::Isolate *isolate)
 
   return maybe_str.IsEmpty() ? v8::String::Empty(isolate) : escapable_handle_scope.Escape(maybe_str.ToLocalChecked());
 }
+// the longer strings are shared with V8 as the external strings, instead of being copied
+static const Py_ssize_t EXTERNAL_STRING_THRESHOLD = 64 * 1024;
+
+static boost::mutex g_released_strings_lock;
+static std::vector<PyObject *> g_released_strings;
+static bool g_released_strings_scheduled = false;
+
+static int ReleaseStrings(void *)
+{
+  std::vector<PyObject *> released;
+
+  {
+    boost::mutex::scoped_lock lock(g_released_strings_lock);
+
+    released.swap(g_released_strings);
+
+    g_released_strings_scheduled = false;
+  }
+
+  for (auto obj : released)
+  {
+    Py_DECREF(obj);
+  }
+
+  return 0;
+}
+
+//
+// The buffer of an immutable Python string exposed to V8, which keeps a reference to the owner.
+//
+// V8 disposes the resource when the string is collected, which may happen while the GIL is released,
+// so the reference is handed to a pending call and released by the interpreter later.
+//
+template <typename T, typename Resource>
+class CPythonStringResource : public Resource
+{
+  PyObject *m_obj;
+  const T *m_data;
+  size_t m_length;
+
+public:
+  CPythonStringResource(PyObject *obj, const T *data, size_t length) : m_obj(obj), m_data(data), m_length(length)
+  {
+    Py_INCREF(m_obj);
+  }
+
+  virtual const T *data() const override { return m_data; }
+  virtual size_t length() const override { return m_length; }
+
+protected:
+  virtual void Dispose() override
+  {
+    bool schedule;
+
+    {
+      boost::mutex::scoped_lock lock(g_released_strings_lock);
+
+      g_released_strings.push_back(m_obj);
+
+      schedule = !g_released_strings_scheduled;
+
+      g_released_strings_scheduled = true;
+    }
+
+    if (schedule && ::Py_AddPendingCall(ReleaseStrings, NULL) < 0)
+    {
+      // the queue is full, the next disposed string will try again
+      boost::mutex::scoped_lock lock(g_released_strings_lock);
+
+      g_released_strings_scheduled = false;
+    }
+
+    delete this;
+  }
+};
+
+typedef CPythonStringResource<char, v8::String::ExternalOneByteStringResource> CPythonOneByteStringResource;
+typedef CPythonStringResource<uint16_t, v8::String::ExternalStringResource> CPythonTwoByteStringResource;
+
+static bool IsAscii(const uint8_t *data, size_t len)
+{
+  uint8_t bits = 0;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    bits |= data[i];
+  }
+
+  return bits < 0x80;
+}
+
+static bool IsExternalizable(Py_ssize_t len)
+{
+  return len >= EXTERNAL_STRING_THRESHOLD && len <= v8::String::kMaxLength;
+}
+
+static v8::MaybeLocal<v8::String> NewFromOneByte(v8::Isolate *isolate, PyObject *obj, const uint8_t *data, Py_ssize_t len)
+{
+  if (IsExternalizable(len))
+  {
+    return v8::String::NewExternalOneByte(isolate,
+                                          new CPythonOneByteStringResource(obj, reinterpret_cast<const char *>(data), len));
+  }
+
+  return v8::String::NewFromOneByte(isolate, data, v8::NewStringType::kNormal, len);
+}
+
+static v8::MaybeLocal<v8::String> NewFromTwoByte(v8::Isolate *isolate, PyObject *obj, const uint16_t *data, Py_ssize_t len)
+{
+  if (IsExternalizable(len))
+  {
+    return v8::String::NewExternalTwoByte(isolate, new CPythonTwoByteStringResource(obj, data, len));
+  }
+
+  return v8::String::NewFromTwoByte(isolate, data, v8::NewStringType::kNormal, len);
+}
+
+static v8::MaybeLocal<v8::String> NewFromUcs4(v8::Isolate *isolate, const uint32_t *data, Py_ssize_t len)
+{
+  std::vector<uint16_t> utf16;
+
+  utf16.reserve(len + 1);
+
+  for (Py_ssize_t i = 0; i < len; i++)
+  {
+    if (data[i] >= 0x10000)
+    {
+      utf16.push_back((uint16_t)(0xD800 + ((data[i] - 0x10000) >> 10)));
+      utf16.push_back((uint16_t)(0xDC00 + ((data[i] - 0x10000) & 0x3FF)));
+    }
+    else
+    {
+      utf16.push_back((uint16_t)(data[i]));
+    }
+  }
+
+  utf16.push_back(0);
+
+  return v8::String::NewFromTwoByte(isolate, &utf16[0], v8::NewStringType::kNormal, utf16.size() - 1);
+}
+
 v8::Handle<v8::String> ToString(py::object str, v8::Isolate *isolate)
 {
   v8::EscapableHandleScope escapable_handle_scope(isolate);
 
   if (PyBytes_CheckExact(str.ptr()))
   {
-    auto maybe_str = v8::String::NewFromUtf8(isolate,
-                                             PyBytes_AS_STRING(str.ptr()),
-                                             v8::NewStringType::kNormal,
-                                             PyBytes_GET_SIZE(str.ptr()));
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(PyBytes_AS_STRING(str.ptr()));
+    Py_ssize_t len = PyBytes_GET_SIZE(str.ptr());
+
+    // the ASCII text is valid as Latin-1 too, so the large ones don't have to be decoded
+    auto maybe_str = IsExternalizable(len) && IsAscii(data, len)
+                         ? NewFromOneByte(isolate, str.ptr(), data, len)
+                         : v8::String::NewFromUtf8(isolate, reinterpret_cast<const char *>(data), v8::NewStringType::kNormal, len);
 
     return maybe_str.IsEmpty() ? v8::String::Empty(isolate) : escapable_handle_scope.Escape(maybe_str.ToLocalChecked());
   }
 
   if (PyUnicode_CheckExact(str.ptr()))
   {
-  #ifndef Py_UNICODE_WIDE
-    auto maybe_str = v8::String::NewFromTwoByte(isolate,
-                                                reinterpret_cast<const uint16_t *>(PyUnicode_AS_UNICODE(str.ptr())),
-                                                v8::NewStringType::kNormal,
-                                                PyUnicode_GET_SIZE(str.ptr()));
-  #else
-    Py_ssize_t len = PyUnicode_GET_SIZE(str.ptr());
-    const uint32_t *p = reinterpret_cast<const uint32_t *>(PyUnicode_AS_UNICODE(str.ptr()));
+    v8::MaybeLocal<v8::String> maybe_str;
+
+  #if PY_VERSION_HEX >= 0x03030000
+    if (PyUnicode_READY(str.ptr()) < 0)
+      py::throw_error_already_set();
 
-    std::vector<uint16_t> data(len+1);
+    Py_ssize_t len = PyUnicode_GET_LENGTH(str.ptr());
 
-    for(Py_ssize_t i=0; i<len; i++)
+    switch (PyUnicode_KIND(str.ptr()))
     {
-      data[i] = (uint16_t) (p[i]);
+    case PyUnicode_1BYTE_KIND:
+      maybe_str = NewFromOneByte(isolate, str.ptr(), PyUnicode_1BYTE_DATA(str.ptr()), len);
+      break;
+    case PyUnicode_2BYTE_KIND:
+      maybe_str = NewFromTwoByte(isolate, str.ptr(), PyUnicode_2BYTE_DATA(str.ptr()), len);
+      break;
+    default:
+      maybe_str = NewFromUcs4(isolate, PyUnicode_4BYTE_DATA(str.ptr()), len);
+      break;
     }
-
-    data[len] = 0;
-
-    auto maybe_str = v8::String::NewFromTwoByte(isolate, &data[0], v8::NewStringType::kNormal, len);
+  #elif !defined(Py_UNICODE_WIDE)
+    maybe_str = NewFromTwoByte(isolate, str.ptr(),
+                               reinterpret_cast<const uint16_t *>(PyUnicode_AS_UNICODE(str.ptr())),
+                               PyUnicode_GET_SIZE(str.ptr()));
+  #else
+    maybe_str = NewFromUcs4(isolate,
+                            reinterpret_cast<const uint32_t *>(PyUnicode_AS_UNICODE(str.ptr())),
+                            PyUnicode_GET_SIZE(str.ptr()));
   #endif
+
     return maybe_str.IsEmpty() ? v8::String::Empty(isolate) : escapable_handle_scope.Escape(maybe_str.ToLocalChecked());
   }
 
@@ -80,6 +237,57 @@ v8::Handle<v8::String> DecodeUtf8(const std::string& str, v8::Isolate *isolate)
   return maybe_str.IsEmpty() ? v8::String::Empty(isolate) : escapable_handle_scope.Escape(maybe_str.ToLocalChecked());
 }
 
+py::object ToBytes(v8::Handle<v8::String> str)
+{
+  // write the UTF-8 encoded string into the Python bytes object directly, without the intermediate buffer
+
+  int len = str->Utf8Length();
+
+  py::object bytes(py::handle<>(::PyBytes_FromStringAndSize(NULL, len)));
+
+  str->WriteUtf8(PyBytes_AS_STRING(bytes.ptr()), len, NULL, v8::String::NO_NULL_TERMINATION);
+
+  return bytes;
+}
+
+py::object ToStr(v8::Handle<v8::String> str)
+{
+#if PY_MAJOR_VERSION < 3
+  return ToBytes(str);
+#else
+  int len = str->Length();
+
+  if (str->IsOneByte())
+  {
+    // most of the one-byte strings are ASCII, which is also the most compact kind of the Python strings
+    py::object result(py::handle<>(::PyUnicode_New(len, 127)));
+
+    Py_UCS1 *data = PyUnicode_1BYTE_DATA(result.ptr());
+
+    str->WriteOneByte(data, 0, len, v8::String::NO_NULL_TERMINATION);
+
+    if (IsAscii(data, len))
+      return result;
+
+    return py::object(py::handle<>(::PyUnicode_FromKindAndData(PyUnicode_1BYTE_KIND, data, len)));
+  }
+
+  std::vector<uint16_t> data(len + 1);
+
+  str->Write(&data[0], 0, len, v8::String::NO_NULL_TERMINATION);
+
+  // keep the lone surrogates, so the string survives the round trip
+#if PY_LITTLE_ENDIAN
+  int byteorder = -1;
+#else
+  int byteorder = 1;
+#endif
+
+  return py::object(py::handle<>(::PyUnicode_DecodeUTF16(reinterpret_cast<const char *>(&data[0]), len * 2,
+                                                         "surrogatepass", &byteorder)));
+#endif
+}
+
 const std::string EncodeUtf8(const std::wstring& str)
 {
   std::vector<uint8_t> data;
@@ -96,12 +304,203 @@ const std::string EncodeUtf8(const std::wstring& str)
   return std::string((const char *) &data[0], data.size());
 }
 
+// how long the batched callbacks may keep the GIL from the other Python threads
+static const std::chrono::milliseconds GIL_BATCH_SLICE(5);
+
+struct CGILThreadState
+{
+  std::vector<CGILAccountPtr> accounts;   // of the entered contexts
+
+  bool released;                          // the thread released the GIL to run Javascript
+  int depth;                              // the CPythonGIL nested within the current run
+
+  bool kept;                              // the GIL is kept by the batched callbacks
+  PyGILState_STATE kept_state;
+
+  size_t interrupt;                       // the watchdog interrupt releasing the kept GIL, if any
+  size_t serial;                          // tells the pending interrupt from a late one already cancelled
+
+  CGILAccount *holder;                    // charged for the time the GIL is held
+  std::chrono::steady_clock::time_point acquired;
+
+  CGILThreadState() : released(false), depth(0), kept(false), interrupt(0), serial(0), holder(NULL) {}
+
+  void Release(PyGILState_STATE state)
+  {
+    if (holder)
+      holder->hold += std::chrono::steady_clock::now() - acquired;
+
+    holder = NULL;
+
+    ::PyGILState_Release(state);
+  }
+};
+
+static thread_local CGILThreadState t_gil;
+
+static void ScheduleRelease(v8::Isolate *isolate);
+
+// runs on the thread executing Javascript, so the GIL kept there can be released by the same thread
+static void ReleaseKeptGIL(v8::Isolate *isolate, void *data)
+{
+  if (!t_gil.interrupt || reinterpret_cast<size_t>(data) != t_gil.serial) return;
+
+  t_gil.interrupt = 0;
+
+  if (!t_gil.kept) return;
+
+  if (std::chrono::steady_clock::now() - t_gil.acquired < GIL_BATCH_SLICE)
+  {
+    // the GIL was released and acquired again since the interrupt was scheduled
+    ScheduleRelease(isolate);
+  }
+  else
+  {
+    t_gil.kept = false;
+
+    t_gil.Release(t_gil.kept_state);
+  }
+}
+
+static void ScheduleRelease(v8::Isolate *isolate)
+{
+  auto left = GIL_BATCH_SLICE - (std::chrono::steady_clock::now() - t_gil.acquired);
+
+  t_gil.interrupt = CWatchdog::Instance().Schedule(isolate, std::chrono::duration<double>(left).count(),
+                                                   ReleaseKeptGIL, reinterpret_cast<void *>(++t_gil.serial));
+}
+
+void CGILAccount::Push(CGILAccountPtr account)
+{
+  t_gil.accounts.push_back(account);
+}
+
+void CGILAccount::Pop(void)
+{
+  if (!t_gil.accounts.empty())
+    t_gil.accounts.pop_back();
+}
+
 CPythonGIL::CPythonGIL()
 {
-  m_state = ::PyGILState_Ensure();
+  if (t_gil.depth++ > 0)
+  {
+    m_mode = Nested;
+  }
+  else if (!t_gil.released)
+  {
+    m_mode = Plain;
+    m_state = ::PyGILState_Ensure();
+  }
+  else if (t_gil.kept)
+  {
+    m_mode = Callback;
+    m_state = t_gil.kept_state;
+
+    t_gil.kept = false;
+
+    if (t_gil.holder)
+      t_gil.holder->reused++;
+  }
+  else
+  {
+    m_mode = Callback;
+
+    auto start = std::chrono::steady_clock::now();
+
+    m_state = ::PyGILState_Ensure();
+
+    t_gil.acquired = std::chrono::steady_clock::now();
+    t_gil.holder = t_gil.accounts.empty() ? NULL : t_gil.accounts.back().get();
+
+    if (t_gil.holder)
+    {
+      t_gil.holder->acquisitions++;
+      t_gil.holder->wait += t_gil.acquired - start;
+    }
+  }
 }
 
 CPythonGIL::~CPythonGIL()
 {
-  ::PyGILState_Release(m_state);
+  t_gil.depth--;
+
+  switch (m_mode)
+  {
+  case Nested:
+    break;
+
+  case Plain:
+    ::PyGILState_Release(m_state);
+    break;
+
+  case Callback:
+    if (t_gil.holder && t_gil.holder->batched &&
+        std::chrono::steady_clock::now() - t_gil.acquired < GIL_BATCH_SLICE)
+    {
+      t_gil.kept = true;
+      t_gil.kept_state = m_state;
+
+      // a long run of pure Javascript must not keep the GIL past its slice
+      if (!t_gil.interrupt)
+        ScheduleRelease(v8::Isolate::GetCurrent());
+    }
+    else
+    {
+      t_gil.Release(m_state);
+    }
+    break;
+  }
+}
+
+CDisposeLocker::CDisposeLocker(v8::Isolate *isolate)
+{
+  if (!v8::Locker::IsActive() || v8::Locker::IsLocked(isolate))
+    return;
+
+  // a thread without the lock isn't running Javascript, so it's a Python thread holding the GIL
+  Py_BEGIN_ALLOW_THREADS
+
+  m_locker.reset(new v8::Locker(isolate));
+
+  Py_END_ALLOW_THREADS
+
+  m_isolate_scope.reset(new v8::Isolate::Scope(isolate));
+}
+
+CAllowThreads::CAllowThreads() : m_released(t_gil.released), m_depth(t_gil.depth), m_holder(t_gil.holder)
+{
+  // a callback running Javascript again, charge its hold so far and resume it later
+  if (m_holder)
+    m_holder->hold += std::chrono::steady_clock::now() - t_gil.acquired;
+
+  t_gil.released = true;
+  t_gil.depth = 0;
+  t_gil.holder = NULL;
+
+  m_save = ::PyEval_SaveThread();
+}
+
+CAllowThreads::~CAllowThreads()
+{
+  if (t_gil.interrupt)
+  {
+    CWatchdog::Instance().Cancel(t_gil.interrupt);
+
+    t_gil.interrupt = 0;
+  }
+
+  if (t_gil.kept)
+  {
+    t_gil.kept = false;
+
+    t_gil.Release(t_gil.kept_state);
+  }
+
+  ::PyEval_RestoreThread(m_save);
+
+  t_gil.released = m_released;
+  t_gil.depth = m_depth;
+  t_gil.holder = m_holder;
+  t_gil.acquired = std::chrono::steady_clock::now();
 }
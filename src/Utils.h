@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
 
 #ifdef _WIN32
 
@@ -80,6 +83,9 @@ namespace py = boost::python;
 
 #include <v8.h>
 
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
 #include "Logger.h"
 
 #ifdef _WIN32
@@ -126,14 +132,87 @@ v8::Handle<v8::String> ToString(py::object str, v8::Isolate *isolate = v8::Isola
 v8::Handle<v8::String> DecodeUtf8(const std::string &str, v8::Isolate *isolate = v8::Isolate::GetCurrent());
 const std::string EncodeUtf8(const std::wstring &str);
 
+py::object ToBytes(v8::Handle<v8::String> str);
+py::object ToStr(v8::Handle<v8::String> str);
+
+//
+// The GIL accounting of the Javascript callbacks, one per JSContext.
+//
+// In the batched mode, a callback keeps the GIL when it returns to Javascript, and the following callbacks
+// of the same run reuse it instead of another PyGILState_Ensure/Release pair, until the GIL has been held
+// for a time slice or the script returns to Python. The watchdog interrupts a run of pure Javascript to
+// release the GIL once its slice has expired.
+//
+struct CGILAccount
+{
+  bool batched;
+
+  size_t acquisitions;              // the GIL acquired by the callbacks while Javascript was running
+  size_t reused;                    // the callbacks served by the GIL kept in the batched mode
+  std::chrono::nanoseconds wait;    // waiting for the GIL
+  std::chrono::nanoseconds hold;    // holding the GIL
+
+  CGILAccount() : batched(false) { Reset(); }
+
+  void Reset(void)
+  {
+    acquisitions = reused = 0;
+    wait = hold = std::chrono::nanoseconds::zero();
+  }
+
+  // the callbacks are charged to the JSContext entered last on the current thread
+  static void Push(boost::shared_ptr<CGILAccount> account);
+  static void Pop(void);
+};
+
+typedef boost::shared_ptr<CGILAccount> CGILAccountPtr;
+
 struct CPythonGIL
 {
+  enum Mode
+  {
+    Nested,   // the thread holds the GIL already
+    Plain,    // a thread outside of the Javascript runs
+    Callback  // a thread that released the GIL to run Javascript
+  };
+
+  Mode m_mode;
   PyGILState_STATE m_state;
 
   CPythonGIL();
   ~CPythonGIL();
 };
 
+//
+// Releases the GIL while V8 runs, like Py_BEGIN_ALLOW_THREADS/Py_END_ALLOW_THREADS,
+// and releases the GIL kept by the batched callbacks before returning to Python.
+//
+class CAllowThreads : private boost::noncopyable
+{
+  PyThreadState *m_save;
+
+  bool m_released;
+  int m_depth;
+  CGILAccount *m_holder;
+
+public:
+  CAllowThreads();
+  ~CAllowThreads();
+};
+
+//
+// Locks the isolate for the V8 calls made outside of any JSLocker once JSLocker has been used,
+// e.g. by a destructor, since the last reference to a wrapper may be dropped on any thread.
+//
+class CDisposeLocker : private boost::noncopyable
+{
+  std::auto_ptr<v8::Locker> m_locker;
+  std::auto_ptr<v8::Isolate::Scope> m_isolate_scope;
+
+public:
+  CDisposeLocker(v8::Isolate *isolate);
+};
+
 #ifdef SUPPORT_PROBES
 
 #define PyObject_t PyObject
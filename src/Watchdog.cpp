@@ -0,0 +1,217 @@
+#include "Watchdog.h"
+
+namespace chr = boost::chrono;
+
+PyObject *CWatchdog::s_timeout_error = NULL;
+
+void CWatchdog::Expose(void)
+{
+  s_timeout_error = ::PyErr_NewException(const_cast<char *>("_PyV8.JSTimeoutError"), ::PyExc_RuntimeError, NULL);
+
+  py::scope().attr("JSTimeoutError") = py::object(py::handle<>(py::borrowed(s_timeout_error)));
+}
+
+CWatchdog &CWatchdog::Instance(void)
+{
+  // never destroyed, the thread lives as long as the process
+  static CWatchdog *s_instance = new CWatchdog();
+
+  return *s_instance;
+}
+
+void CWatchdog::Add(Scope *scope)
+{
+  lock_guard_t lock(m_lock);
+
+  m_scopes.insert(scope);
+
+  if (!m_thread.get())
+  {
+    m_thread.reset(new boost::thread(&CWatchdog::Run, this));
+  }
+
+  m_cond.notify_one();
+}
+
+size_t CWatchdog::Schedule(v8::Isolate *isolate, double delay, v8::InterruptCallback callback, void *data)
+{
+  lock_guard_t lock(m_lock);
+
+  Interrupt interrupt = { isolate, clock_type::now() + chr::microseconds(static_cast<int64_t>(delay * 1000000)), callback, data };
+
+  size_t token = ++m_next_interrupt;
+
+  m_interrupts.insert(std::make_pair(token, interrupt));
+
+  if (!m_thread.get())
+  {
+    m_thread.reset(new boost::thread(&CWatchdog::Run, this));
+  }
+
+  m_cond.notify_one();
+
+  return token;
+}
+
+void CWatchdog::Cancel(size_t token)
+{
+  lock_guard_t lock(m_lock);
+
+  m_interrupts.erase(token);
+}
+
+bool CWatchdog::Remove(Scope *scope)
+{
+  lock_guard_t lock(m_lock);
+
+  m_scopes.erase(scope);
+
+  return scope->m_expired;
+}
+
+void CWatchdog::Run(void)
+{
+  lock_guard_t lock(m_lock);
+
+  while (true)
+  {
+    if (m_scopes.empty() && m_interrupts.empty())
+    {
+      m_cond.wait(lock);
+
+      continue;
+    }
+
+    time_point now = clock_type::now(), wakeup = now + chr::seconds(1);
+
+    for (std::set<Scope *>::iterator it = m_scopes.begin(); it != m_scopes.end(); ++it)
+    {
+      (*it)->Check(now, wakeup);
+    }
+
+    for (std::map<size_t, Interrupt>::iterator it = m_interrupts.begin(); it != m_interrupts.end(); )
+    {
+      if (now >= it->second.due)
+      {
+        it->second.isolate->RequestInterrupt(it->second.callback, it->second.data);
+
+        it = m_interrupts.erase(it);
+      }
+      else
+      {
+        if (it->second.due < wakeup) wakeup = it->second.due;
+
+        ++it;
+      }
+    }
+
+    m_cond.wait_until(lock, wakeup);
+  }
+}
+
+CWatchdog::Scope::Scope(v8::Isolate *isolate, double timeout, double cpu_budget)
+    : m_isolate(isolate), m_deadline(CWatchdog::time_point::max()), m_cpu_budget(cpu_budget), m_cpu_start(0),
+      m_armed(timeout > 0 || cpu_budget > 0), m_expired(false), m_reason(NULL)
+{
+  if (!m_armed) return;
+
+  if (timeout > 0)
+  {
+    m_deadline = CWatchdog::clock_type::now() + chr::microseconds(static_cast<int64_t>(timeout * 1000000));
+  }
+
+  if (cpu_budget > 0)
+  {
+#ifdef _WIN32
+    ::DuplicateHandle(::GetCurrentProcess(), ::GetCurrentThread(), ::GetCurrentProcess(), &m_thread,
+                      0, FALSE, DUPLICATE_SAME_ACCESS);
+#else
+    if (0 != ::pthread_getcpuclockid(::pthread_self(), &m_clock))
+      throw CJavascriptException("thread CPU clock is not available", ::PyExc_RuntimeError);
+#endif
+
+    m_cpu_start = GetCpuTime();
+  }
+
+  CWatchdog::Instance().Add(this);
+}
+
+CWatchdog::Scope::~Scope()
+{
+  Disarm();
+
+#ifdef _WIN32
+  if (m_cpu_budget > 0) ::CloseHandle(m_thread);
+#endif
+}
+
+bool CWatchdog::Scope::Disarm(void)
+{
+  if (m_armed)
+  {
+    m_armed = false;
+
+    CWatchdog::Instance().Remove(this);
+  }
+
+  return m_expired;
+}
+
+double CWatchdog::Scope::GetCpuTime(void) const
+{
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+
+  if (!::GetThreadTimes(m_thread, &creation, &exit, &kernel, &user)) return 0;
+
+  return ((static_cast<uint64_t>(kernel.dwHighDateTime) << 32 | kernel.dwLowDateTime) +
+          (static_cast<uint64_t>(user.dwHighDateTime) << 32 | user.dwLowDateTime)) / 1e7;
+#else
+  struct timespec ts;
+
+  if (0 != ::clock_gettime(m_clock, &ts)) return 0;
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+void CWatchdog::Scope::Check(const CWatchdog::time_point &now, CWatchdog::time_point &wakeup)
+{
+  if (m_expired) return;
+
+  if (m_deadline != CWatchdog::time_point::max())
+  {
+    if (now >= m_deadline)
+    {
+      m_reason = "timeout";
+    }
+    else if (m_deadline < wakeup)
+    {
+      wakeup = m_deadline;
+    }
+  }
+
+  if (!m_reason && m_cpu_budget > 0)
+  {
+    double left = m_cpu_budget - (GetCpuTime() - m_cpu_start);
+
+    if (left <= 0)
+    {
+      m_reason = "CPU budget";
+    }
+    else
+    {
+      // the thread can't burn its CPU budget faster than the wall clock
+      CWatchdog::time_point due = now + chr::microseconds(static_cast<int64_t>(left * 1000000) + 1000);
+
+      if (due < wakeup) wakeup = due;
+    }
+  }
+
+  if (m_reason)
+  {
+    m_expired = true;
+
+    m_isolate->TerminateExecution();
+  }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <set>
+#include <map>
+#include <memory>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/chrono.hpp>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+  #include <time.h>
+#endif
+
+#include "Exception.h"
+
+//
+// A shared background thread which enforces the wall-clock and CPU time budgets of script executions.
+//
+// The executing thread arms a CWatchdog::Scope for the duration of a run; when a budget is exhausted
+// the watchdog calls TerminateExecution on the scope's isolate. The scope cancels the termination
+// after the script has unwound, so the caller can raise JSTimeoutError and keep using the context.
+//
+// The same thread also delivers the timed interrupts, which run a callback on the thread executing
+// the isolate's Javascript once their delay has passed.
+//
+class CWatchdog
+{
+public:
+  class Scope;
+
+  // the deadlines follow the monotonic clock, so a step of the wall clock can't fire or hold them
+  typedef boost::chrono::steady_clock clock_type;
+  typedef clock_type::time_point time_point;
+
+private:
+  typedef boost::mutex lock_t;
+  typedef boost::unique_lock<lock_t> lock_guard_t;
+
+  struct Interrupt
+  {
+    v8::Isolate *isolate;
+    time_point due;
+    v8::InterruptCallback callback;
+    void *data;
+  };
+
+  lock_t m_lock;
+  boost::condition_variable m_cond;
+  std::set<Scope *> m_scopes;
+  std::map<size_t, Interrupt> m_interrupts;
+  size_t m_next_interrupt;
+  std::unique_ptr<boost::thread> m_thread;
+
+  CWatchdog() : m_next_interrupt(0) {}
+
+  static PyObject *s_timeout_error;
+
+  void Run(void);
+
+  void Add(Scope *scope);
+  bool Remove(Scope *scope);
+
+public:
+  static CWatchdog &Instance(void);
+
+  // request an interrupt of the isolate after the delay (in seconds), returns a token to cancel it;
+  // the isolate must outlive the interrupt, or the interrupt be cancelled before the isolate is disposed
+  size_t Schedule(v8::Isolate *isolate, double delay, v8::InterruptCallback callback, void *data);
+  void Cancel(size_t token);
+
+  static PyObject *TimeoutError(void) { return s_timeout_error; }
+
+  static void Expose(void);
+};
+
+class CWatchdog::Scope : private boost::noncopyable
+{
+  friend class CWatchdog;
+
+  v8::Isolate *m_isolate;
+  CWatchdog::time_point m_deadline; // time_point::max() if unlimited
+  double m_cpu_budget, m_cpu_start;
+  bool m_armed, m_expired;
+  const char *m_reason;
+
+#ifdef _WIN32
+  HANDLE m_thread;
+#else
+  clockid_t m_clock;
+#endif
+
+  double GetCpuTime(void) const;
+
+  // called by the watchdog thread with its lock held
+  void Check(const CWatchdog::time_point &now, CWatchdog::time_point &wakeup);
+
+public:
+  // a timeout or cpu_budget (in seconds) of zero means unlimited
+  Scope(v8::Isolate *isolate, double timeout, double cpu_budget);
+  ~Scope();
+
+  // stop watching, returns true if the watchdog has terminated the execution
+  bool Disarm(void);
+
+  const char *GetReason(void) const { return m_reason; }
+};
@@ -1,10 +1,12 @@
 #include "Wrapper.h"
 
 #include <stdlib.h>
+#include <stdint.h>
 
 #include <vector>
+#include <algorithm>
 
-#include <boost/preprocessor.hpp>
+#include <boost/pool/singleton_pool.hpp>
 #include <boost/python/raw_function.hpp>
 
 #include <descrobject.h>
@@ -37,10 +39,26 @@ std::ostream &operator<<(std::ostream &os, const CJavascriptObject &obj)
   return os;
 }
 
+static py::object ToPythonTree(CJavascriptObject &obj, int depth, bool cycles) { return obj.ToPython(depth, cycles); }
+static py::object ToJSONBytes(CJavascriptObject &obj) { return obj.ToJSON(); }
+
 void CWrapper::Expose(void)
 {
   PyDateTime_IMPORT;
 
+  // module functions instead of methods, which would shadow the Javascript properties with the same names
+
+  py::def("toPython", &ToPythonTree, (py::arg("obj"),
+                                      py::arg("depth") = -1,
+                                      py::arg("cycles") = true),
+          "Convert the object graph to Python dict/list tree in one pass, "
+          "keep the shared and cyclic references if cycles is true, or raise ValueError on a cycle.");
+  py::def("fromPython", &CJavascriptObject::FromPython, (py::arg("obj"),
+                                                         py::arg("depth") = -1),
+          "Convert the Python dict/list/tuple tree to Javascript objects and arrays in one pass.");
+  py::def("toJSON", &ToJSONBytes, (py::arg("obj")),
+          "Serialize the object to the UTF-8 encoded JSON bytes.");
+
   py::class_<CJavascriptObject, boost::noncopyable>("JSObject", py::no_init)
       .def("__getattr__", &CJavascriptObject::GetAttr)
       .def("__setattr__", &CJavascriptObject::SetAttr)
@@ -117,6 +135,15 @@ void CWrapper::Expose(void)
            (py::arg("args") = py::list(),
             py::arg("kwds") = py::dict()),
            "Performs a binding method call using the parameters.")
+      .def("map", &CJavascriptFunction::Map,
+           (py::arg("iterable"),
+            py::arg("chunk") = 256,
+            py::arg("collect_errors") = false),
+           "Calls the function for each item of the iterable, a tuple item is passed as the argument list.")
+      .def("callMany", &CJavascriptFunction::CallMany,
+           (py::arg("args"),
+            py::arg("collect_errors") = false),
+           "Calls the function once per argument sequence and returns a list of results.")
 
       .def("setName", &CJavascriptFunction::SetName)
 
@@ -128,7 +155,25 @@ void CWrapper::Expose(void)
       .add_property("resname", &CJavascriptFunction::GetResourceName, "The resource name of script")
       .add_property("inferredname", &CJavascriptFunction::GetInferredName, "Name inferred from variable or property assignment of this function")
       .add_property("lineoff", &CJavascriptFunction::GetLineOffset, "The line offset of function in the script")
-      .add_property("coloff", &CJavascriptFunction::GetColumnOffset, "The column offset of function in the script");
+      .add_property("coloff", &CJavascriptFunction::GetColumnOffset, "The column offset of function in the script")
+      .add_property("context", &CJavascriptObject::GetContext, "The context in which the function was created");
+
+  py::enum_<v8::Promise::PromiseState>("JSPromiseState")
+      .value("pending", v8::Promise::kPending)
+      .value("fulfilled", v8::Promise::kFulfilled)
+      .value("rejected", v8::Promise::kRejected);
+
+  py::class_<CJavascriptPromise, py::bases<CJavascriptObject>, boost::noncopyable>("JSPromise", py::no_init)
+      .add_property("context", &CJavascriptObject::GetContext, "The context in which the promise was created")
+      .add_property("state", &CJavascriptPromise::GetState, "The state of the promise, pending, fulfilled or rejected")
+      .add_property("result", &CJavascriptPromise::GetResult, "The fulfilled value or the rejected reason of the settled promise")
+
+      .def("then", &CJavascriptPromise::Then, (py::arg("onFulfilled") = py::object(),
+                                               py::arg("onRejected") = py::object()),
+           "Appends the fulfillment and rejection callbacks to the promise, "
+           "and returns a new promise resolving to the return value of the called callback.");
+
+  CJavascriptArrayBuffer::Expose();
 
   py::objects::class_value_wrapper<boost::shared_ptr<CJavascriptObject>,
                                    py::objects::make_ptr_instance<CJavascriptObject,
@@ -281,12 +326,12 @@ void CPythonObject::NamedGetter(v8::Local<v8::String> prop, const v8::PropertyCa
 
   py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  v8::String::Utf8Value name(prop);
-
   if (PyGen_Check(obj.ptr()))
     CALLBACK_RETURN(v8::Undefined(info.GetIsolate()));
 
-  PyObject *value = ::PyObject_GetAttrString(obj.ptr(), *name);
+  py::object name = CIsolate(info.GetIsolate()).PropertyNames().Get(prop);
+
+  PyObject *value = ::PyObject_GetAttr(obj.ptr(), name.ptr());
 
   if (!value)
   {
@@ -303,9 +348,9 @@ void CPythonObject::NamedGetter(v8::Local<v8::String> prop, const v8::PropertyCa
     }
 
     if (::PyMapping_Check(obj.ptr()) &&
-        ::PyMapping_HasKeyString(obj.ptr(), *name))
+        ::PyMapping_HasKey(obj.ptr(), name.ptr()))
     {
-      py::object result(py::handle<>(::PyMapping_GetItemString(obj.ptr(), *name)));
+      py::object result(py::handle<>(::PyObject_GetItem(obj.ptr(), name.ptr())));
 
       if (!result.is_none())
         CALLBACK_RETURN(Wrap(result));
@@ -333,44 +378,32 @@ void CPythonObject::NamedGetter(v8::Local<v8::String> prop, const v8::PropertyCa
   END_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
 }
 
-void CPythonObject::NamedSetter(v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::PropertyCallbackInfo<v8::Value> &info)
+void CPythonObject::SetAttribute(py::object obj, py::object name, py::object newval)
 {
-  v8::HandleScope handle_scope(info.GetIsolate());
-
-  TRY_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
-
-  CPythonGIL python_gil;
-
-  py::object obj = CJavascriptObject::Wrap(info.Holder());
-
-  v8::String::Utf8Value name(prop);
-  py::object newval = CJavascriptObject::Wrap(value);
-
-  bool found = 1 == ::PyObject_HasAttrString(obj.ptr(), *name);
+  bool found = 1 == ::PyObject_HasAttr(obj.ptr(), name.ptr());
 
   if (::PyObject_HasAttrString(obj.ptr(), "__watchpoints__"))
   {
     py::dict watchpoints(obj.attr("__watchpoints__"));
-    py::str propname(*name, name.length());
 
-    if (watchpoints.has_key(propname))
+    if (watchpoints.has_key(name))
     {
-      py::object watchhandler = watchpoints.get(propname);
+      py::object watchhandler = watchpoints.get(name);
 
-      newval = watchhandler(propname, found ? obj.attr(propname) : py::object(), newval);
+      newval = watchhandler(name, found ? obj.attr(name) : py::object(), newval);
     }
   }
 
   if (!found && ::PyMapping_Check(obj.ptr()))
   {
-    ::PyMapping_SetItemString(obj.ptr(), *name, newval.ptr());
+    ::PyObject_SetItem(obj.ptr(), name.ptr(), newval.ptr());
   }
   else
   {
 #ifdef SUPPORT_PROPERTY
     if (found)
     {
-      py::object attr = obj.attr(*name);
+      py::object attr = obj.attr(name);
 
       if (PyObject_TypeCheck(attr.ptr(), &::PyProperty_Type))
       {
@@ -381,12 +414,27 @@ void CPythonObject::NamedSetter(v8::Local<v8::String> prop, v8::Local<v8::Value>
 
         setter(newval);
 
-        CALLBACK_RETURN(value);
+        return;
       }
     }
 #endif
-    obj.attr(*name) = newval;
+    obj.attr(name) = newval;
   }
+}
+
+void CPythonObject::NamedSetter(v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::PropertyCallbackInfo<v8::Value> &info)
+{
+  v8::HandleScope handle_scope(info.GetIsolate());
+
+  TRY_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
+
+  CPythonGIL python_gil;
+
+  py::object obj = CJavascriptObject::Wrap(info.Holder());
+
+  py::object name = CIsolate(info.GetIsolate()).PropertyNames().Get(prop);
+
+  SetAttribute(obj, name, CJavascriptObject::Wrap(value));
 
   CALLBACK_RETURN(value);
 
@@ -403,10 +451,10 @@ void CPythonObject::NamedQuery(v8::Local<v8::String> prop, const v8::PropertyCal
 
   py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  v8::String::Utf8Value name(prop);
+  py::object name = CIsolate(info.GetIsolate()).PropertyNames().Get(prop);
 
-  bool exists = PyGen_Check(obj.ptr()) || ::PyObject_HasAttrString(obj.ptr(), *name) ||
-                (::PyMapping_Check(obj.ptr()) && ::PyMapping_HasKeyString(obj.ptr(), *name));
+  bool exists = PyGen_Check(obj.ptr()) || ::PyObject_HasAttr(obj.ptr(), name.ptr()) ||
+                (::PyMapping_Check(obj.ptr()) && ::PyMapping_HasKey(obj.ptr(), name.ptr()));
 
   if (exists)
     CALLBACK_RETURN(v8::Integer::New(info.GetIsolate(), v8::None));
@@ -424,20 +472,20 @@ void CPythonObject::NamedDeleter(v8::Local<v8::String> prop, const v8::PropertyC
 
   py::object obj = CJavascriptObject::Wrap(info.Holder());
 
-  v8::String::Utf8Value name(prop);
+  py::object name = CIsolate(info.GetIsolate()).PropertyNames().Get(prop);
 
-  if (!::PyObject_HasAttrString(obj.ptr(), *name) &&
+  if (!::PyObject_HasAttr(obj.ptr(), name.ptr()) &&
       ::PyMapping_Check(obj.ptr()) &&
-      ::PyMapping_HasKeyString(obj.ptr(), *name))
+      ::PyMapping_HasKey(obj.ptr(), name.ptr()))
   {
-    CALLBACK_RETURN(-1 != ::PyMapping_DelItemString(obj.ptr(), *name));
+    CALLBACK_RETURN(-1 != ::PyObject_DelItem(obj.ptr(), name.ptr()));
   }
   else
   {
 #ifdef SUPPORT_PROPERTY
-    py::object attr = obj.attr(*name);
+    py::object attr = obj.attr(name);
 
-    if (::PyObject_HasAttrString(obj.ptr(), *name) &&
+    if (::PyObject_HasAttr(obj.ptr(), name.ptr()) &&
         PyObject_TypeCheck(attr.ptr(), &::PyProperty_Type))
     {
       py::object deleter = attr.attr("fdel");
@@ -449,10 +497,10 @@ void CPythonObject::NamedDeleter(v8::Local<v8::String> prop, const v8::PropertyC
     }
     else
     {
-      CALLBACK_RETURN(-1 != ::PyObject_DelAttrString(obj.ptr(), *name));
+      CALLBACK_RETURN(-1 != ::PyObject_DelAttr(obj.ptr(), name.ptr()));
     }
 #else
-    CALLBACK_RETURN(-1 != ::PyObject_DelAttrString(obj.ptr(), *name));
+    CALLBACK_RETURN(-1 != ::PyObject_DelAttr(obj.ptr(), name.ptr()));
 #endif
   }
 
@@ -690,27 +738,109 @@ void CPythonObject::IndexedEnumerator(const v8::PropertyCallbackInfo<v8::Array>
   END_HANDLE_EXCEPTION(v8::Handle<v8::Array>())
 }
 
-#define GEN_ARG(z, n, data) CJavascriptObject::Wrap(info[n])
-#define GEN_ARGS(count) BOOST_PP_ENUM(count, GEN_ARG, NULL)
+static v8::Handle<v8::Object> FindWrappedObject(v8::Handle<v8::Value> value)
+{
+  // the member accessors live on the prototype, the receiver may be any object inheriting from it
+
+  while (value->IsObject())
+  {
+    v8::Handle<v8::Object> obj = value->ToObject();
+
+    if (CPythonObject::IsWrapped(obj) && obj->GetInternalField(0)->IsExternal())
+      return obj;
+
+    value = obj->GetPrototype();
+  }
+
+  return v8::Handle<v8::Object>();
+}
+
+void CPythonObject::MemberGetter(v8::Local<v8::String> prop, const v8::PropertyCallbackInfo<v8::Value> &info)
+{
+  v8::HandleScope handle_scope(info.GetIsolate());
+
+  TRY_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
+
+  CPythonGIL python_gil;
+
+  v8::Handle<v8::Object> holder = FindWrappedObject(info.This());
+
+  if (holder.IsEmpty())
+    CALLBACK_RETURN(v8::Undefined(info.GetIsolate()));
+
+  py::object obj = CJavascriptObject::Wrap(holder);
+
+  PyObject *name = static_cast<PyObject *>(v8::Handle<v8::External>::Cast(info.Data())->Value());
+
+  PyObject *value = ::PyObject_GetAttr(obj.ptr(), name);
+
+  if (!value)
+  {
+    if (!::PyErr_ExceptionMatches(::PyExc_AttributeError))
+      py::throw_error_already_set();
+
+    ::PyErr_Clear();
+
+    CALLBACK_RETURN(v8::Undefined(info.GetIsolate()));
+  }
+
+  py::object attr = py::object(py::handle<>(value));
+
+#ifdef SUPPORT_PROPERTY
+  if (PyObject_TypeCheck(attr.ptr(), &::PyProperty_Type))
+  {
+    py::object getter = attr.attr("fget");
+
+    if (getter.is_none())
+      throw CJavascriptException("unreadable attribute", ::PyExc_AttributeError);
+
+    attr = getter();
+  }
+#endif
+
+  CALLBACK_RETURN(Wrap(attr));
+
+  END_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
+}
+
+void CPythonObject::MemberSetter(v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::PropertyCallbackInfo<void> &info)
+{
+  v8::HandleScope handle_scope(info.GetIsolate());
+
+  if (v8::V8::IsExecutionTerminating())
+    return;
+
+  BEGIN_HANDLE_PYTHON_EXCEPTION
+  {
+    CPythonGIL python_gil;
+
+    v8::Handle<v8::Object> holder = FindWrappedObject(info.This());
+
+    if (holder.IsEmpty())
+      return;
+
+    PyObject *name = static_cast<PyObject *>(v8::Handle<v8::External>::Cast(info.Data())->Value());
+
+    SetAttribute(CJavascriptObject::Wrap(holder), py::object(py::handle<>(py::borrowed(name))), CJavascriptObject::Wrap(value));
+  }
+  END_HANDLE_PYTHON_EXCEPTION
+}
+
+py::object CPythonObject::Apply(PyObject *callable, const v8::FunctionCallbackInfo<v8::Value> &info)
+{
+  Py_ssize_t argc = info.Length();
+
+  py::tuple args(py::handle<>(::PyTuple_New(argc)));
 
-#define GEN_CASE_PRED(r, state)                       \
-  BOOST_PP_NOT_EQUAL(                                 \
-      BOOST_PP_TUPLE_ELEM(2, 0, state),               \
-      BOOST_PP_INC(BOOST_PP_TUPLE_ELEM(2, 1, state))) \
-/**/
+  for (Py_ssize_t i = 0; i < argc; i++)
+  {
+    py::object arg = CJavascriptObject::Wrap(info[i]);
 
-#define GEN_CASE_OP(r, state)                         \
-  (                                                   \
-      BOOST_PP_INC(BOOST_PP_TUPLE_ELEM(2, 0, state)), \
-      BOOST_PP_TUPLE_ELEM(2, 1, state)) /**/
+    PyTuple_SET_ITEM(args.ptr(), i, py::incref(arg.ptr()));
+  }
 
-#define GEN_CASE_MACRO(r, state)                               \
-  case BOOST_PP_TUPLE_ELEM(2, 0, state):                       \
-  {                                                            \
-    result = self(GEN_ARGS(BOOST_PP_TUPLE_ELEM(2, 0, state))); \
-    break;                                                     \
-  }                                                            \
-/**/
+  return py::object(py::handle<>(::PyObject_Call(callable, args.ptr(), NULL)));
+}
 
 void CPythonObject::Caller(const v8::FunctionCallbackInfo<v8::Value> &info)
 {
@@ -720,33 +850,77 @@ void CPythonObject::Caller(const v8::FunctionCallbackInfo<v8::Value> &info)
 
   CPythonGIL python_gil;
 
-  py::object self;
+  py::object result;
 
   if (!info.Data().IsEmpty() && info.Data()->IsExternal())
   {
-    v8::Handle<v8::External> field = v8::Handle<v8::External>::Cast(info.Data());
+    // the template data is a weak reference to the type
+    PyObject *target = PyWeakref_GET_OBJECT(static_cast<py::object *>(v8::Handle<v8::External>::Cast(info.Data())->Value())->ptr());
 
-    self = *static_cast<py::object *>(field->Value());
+    if (target == Py_None)
+      throw CJavascriptException("the Python type has been released", ::PyExc_ReferenceError);
+
+    py::object type(py::handle<>(py::borrowed(target)));
+
+    result = Apply(type.ptr(), info);
   }
   else
   {
-    self = CJavascriptObject::Wrap(info.This());
+    py::object self = CJavascriptObject::Wrap(info.This());
+
+    result = Apply(self.ptr(), info);
   }
 
-  py::object result;
+  CALLBACK_RETURN(Wrap(result));
+
+  END_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
+}
+
+// the largest integer which a double can represent exactly, Number.MAX_SAFE_INTEGER
+static const int64_t MAX_SAFE_INTEGER = (1LL << 53) - 1;
+
+static PyObject *IntegerFromLongLong(long long value)
+{
+#if PY_MAJOR_VERSION < 3
+  if (value >= LONG_MIN && value <= LONG_MAX)
+    return ::PyInt_FromLong(static_cast<long>(value));
+#endif
+
+  return ::PyLong_FromLongLong(value);
+}
+
+v8::Handle<v8::Value> CPythonObject::WrapInteger(int64_t value)
+{
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  if (value >= INT32_MIN && value <= INT32_MAX)
+    return v8::Integer::New(isolate, static_cast<int32_t>(value));
+
+  if (value >= 0 && value <= UINT32_MAX)
+    return v8::Integer::NewFromUnsigned(isolate, static_cast<uint32_t>(value));
+
+  return v8::Number::New(isolate, static_cast<double>(value));
+}
+
+v8::Handle<v8::Value> CPythonObject::WrapLong(PyObject *obj)
+{
+  int overflow = 0;
+
+  long long value = ::PyLong_AsLongLongAndOverflow(obj, &overflow);
 
-  switch (info.Length())
+  if (!overflow)
   {
-    BOOST_PP_FOR((0, 10), GEN_CASE_PRED, GEN_CASE_OP, GEN_CASE_MACRO)
-  default:
-    info.GetIsolate()->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(info.GetIsolate(), "too many arguments")));
+    if (value == -1 && ::PyErr_Occurred()) py::throw_error_already_set();
 
-    CALLBACK_RETURN(v8::Undefined(info.GetIsolate()));
+    return WrapInteger(value);
   }
 
-  CALLBACK_RETURN(Wrap(result));
+  // V8 has no BigInt yet, the nearest Number is the best it can hold
+  double number = ::PyLong_AsDouble(obj);
 
-  END_HANDLE_EXCEPTION(v8::Undefined(info.GetIsolate()))
+  if (number == -1.0 && ::PyErr_Occurred()) py::throw_error_already_set();
+
+  return v8::Number::New(v8::Isolate::GetCurrent(), number);
 }
 
 void CPythonObject::SetupObjectTemplate(v8::Isolate *isolate, v8::Handle<v8::ObjectTemplate> clazz)
@@ -770,6 +944,43 @@ v8::Handle<v8::ObjectTemplate> CPythonObject::CreateObjectTemplate(v8::Isolate *
   return handle_scope.Escape(clazz);
 }
 
+v8::Handle<v8::FunctionTemplate> CPythonObject::CreateTypeTemplate(v8::Isolate *isolate, py::object *type,
+                                                                   const std::vector<PyObject *> &members)
+{
+  v8::EscapableHandleScope handle_scope(isolate);
+
+  // calling the constructor in Javascript creates a new instance of the Python type
+
+  v8::Local<v8::FunctionTemplate> func_tmpl = v8::FunctionTemplate::New(isolate, Caller, v8::External::New(isolate, type));
+
+  v8::Local<v8::ObjectTemplate> clazz = func_tmpl->InstanceTemplate();
+
+  clazz->SetInternalFieldCount(1);
+  clazz->SetHandler(v8::NamedPropertyHandlerConfiguration(NamedAdapter<v8::Value, NamedGetter>,
+                                                          NamedSetterAdapter,
+                                                          NamedAdapter<v8::Integer, NamedQuery>,
+                                                          NamedAdapter<v8::Boolean, NamedDeleter>,
+                                                          NamedEnumerator));
+  clazz->SetIndexedPropertyHandler(IndexedGetter, IndexedSetter, IndexedQuery, IndexedDeleter, IndexedEnumerator);
+  clazz->SetCallAsFunctionHandler(Caller);
+
+  v8::Local<v8::ObjectTemplate> proto = func_tmpl->PrototypeTemplate();
+
+  for (std::vector<PyObject *>::const_iterator it = members.begin(); it != members.end(); it++)
+  {
+#if PY_MAJOR_VERSION < 3
+    const char *name = PyString_AS_STRING(*it);
+#else
+    const char *name = PyUnicode_AsUTF8(*it);
+#endif
+
+    proto->SetAccessor(v8::String::NewFromUtf8(isolate, name, v8::String::kInternalizedString),
+                       MemberGetter, MemberSetter, v8::External::New(isolate, *it), v8::DEFAULT, v8::DontEnum);
+  }
+
+  return handle_scope.Escape(func_tmpl);
+}
+
 bool CPythonObject::IsWrapped(v8::Handle<v8::Object> obj)
 {
   return obj->InternalFieldCount() == 1;
@@ -875,13 +1086,13 @@ v8::Handle<v8::Value> CPythonObject::WrapInternal(py::object obj)
 #if PY_MAJOR_VERSION < 3
   if (PyInt_CheckExact(obj.ptr()))
   {
-    result = v8::Integer::New(v8::Isolate::GetCurrent(), ::PyInt_AsLong(obj.ptr()));
+    result = WrapInteger(PyInt_AS_LONG(obj.ptr()));
   }
   else
 #endif
       if (PyLong_CheckExact(obj.ptr()))
   {
-    result = v8::Integer::New(v8::Isolate::GetCurrent(), ::PyLong_AsLong(obj.ptr()));
+    result = WrapLong(obj.ptr());
   }
   else if (PyBool_Check(obj.ptr()))
   {
@@ -908,66 +1119,873 @@ v8::Handle<v8::Value> CPythonObject::WrapInternal(py::object obj)
     ts.tm_sec = PyDateTime_DATE_GET_SECOND(obj.ptr());
     ts.tm_isdst = -1;
 
-    int ms = PyDateTime_DATE_GET_MICROSECOND(obj.ptr());
+    int ms = PyDateTime_DATE_GET_MICROSECOND(obj.ptr());
+
+    result = v8::Date::New(v8::Isolate::GetCurrent(), ((double)mktime(&ts)) * 1000 + ms / 1000);
+  }
+  else if (PyTime_CheckExact(obj.ptr()))
+  {
+    tm ts = {0};
+
+    ts.tm_hour = PyDateTime_TIME_GET_HOUR(obj.ptr()) - 1;
+    ts.tm_min = PyDateTime_TIME_GET_MINUTE(obj.ptr());
+    ts.tm_sec = PyDateTime_TIME_GET_SECOND(obj.ptr());
+
+    int ms = PyDateTime_TIME_GET_MICROSECOND(obj.ptr());
+
+    result = v8::Date::New(v8::Isolate::GetCurrent(), ((double)mktime(&ts)) * 1000 + ms / 1000);
+  }
+  else if (PyCFunction_Check(obj.ptr()) || PyFunction_Check(obj.ptr()) ||
+           PyMethod_Check(obj.ptr()) || PyType_Check(obj.ptr()))
+  {
+    v8::Handle<v8::FunctionTemplate> func_tmpl = v8::FunctionTemplate::New(v8::Isolate::GetCurrent());
+    py::object *object = new py::object(obj);
+
+    func_tmpl->SetCallHandler(Caller, v8::External::New(v8::Isolate::GetCurrent(), object));
+
+    if (PyType_Check(obj.ptr()))
+    {
+      v8::Handle<v8::String> cls_name = v8::String::NewFromUtf8(v8::Isolate::GetCurrent(), py::extract<const char *>(obj.attr("__name__"))());
+
+      func_tmpl->SetClassName(cls_name);
+    }
+
+    result = func_tmpl->GetFunction();
+
+#ifdef SUPPORT_TRACE_LIFECYCLE
+    if (!result.IsEmpty())
+      ObjectTracer::Trace(result, object);
+#endif
+  }
+  else if (::PyObject_CheckBuffer(obj.ptr()) && !PyBytes_Check(obj.ptr()) && !PyUnicode_Check(obj.ptr()))
+  {
+    result = WrapBuffer(obj);
+  }
+  else
+  {
+    v8::Handle<v8::Object> instance = CIsolate::Current().ObjectTemplate(Py_TYPE(obj.ptr()))->NewInstance();
+
+    if (!instance.IsEmpty())
+    {
+      py::object *object = new py::object(obj);
+
+      instance->SetInternalField(0, v8::External::New(v8::Isolate::GetCurrent(), object));
+
+#ifdef SUPPORT_TRACE_LIFECYCLE
+      ObjectTracer::Trace(instance, object).SetWrapperClassId(WRAPPER_CLASS_ID);
+#endif
+    }
+
+    result = instance;
+  }
+
+  if (result.IsEmpty())
+    CJavascriptException::ThrowIf(v8::Isolate::GetCurrent(), try_catch);
+
+  return handle_scope.Escape(result);
+}
+
+CObjectTemplateCache::CObjectTemplateCache(v8::Isolate *isolate)
+    : m_isolate(isolate), m_sweep_size(MAX_MEMBERS), m_property_names(isolate)
+{
+}
+
+CObjectTemplateCache::~CObjectTemplateCache()
+{
+  m_entries.clear();
+  m_generic.Reset();
+}
+
+v8::Local<v8::ObjectTemplate> CObjectTemplateCache::Generic(void)
+{
+  if (m_generic.IsEmpty())
+  {
+    v8::HandleScope handle_scope(m_isolate);
+
+    m_generic.Reset(m_isolate, CPythonObject::CreateObjectTemplate(m_isolate));
+  }
+
+  return v8::Local<v8::ObjectTemplate>::New(m_isolate, m_generic);
+}
+
+bool CObjectTemplateCache::IsSpecializable(PyTypeObject *type)
+{
+  // only the types with the generic attribute lookup, otherwise the members could not be known in advance,
+  // and the mapping types keep their keys in front of the builtin properties of Javascript object.
+
+  if (type->tp_getattro != ::PyObject_GenericGetAttr || !type->tp_mro || !type->tp_dict)
+    return false;
+
+  if (type->tp_as_mapping && type->tp_as_mapping->mp_subscript)
+    return false;
+
+  if (type == &::PyGen_Type)
+    return false;
+
+#ifdef Py_TPFLAGS_HAVE_VERSION_TAG
+  return PyType_HasFeature(type, Py_TPFLAGS_HAVE_VERSION_TAG);
+#else
+  return true;
+#endif
+}
+
+v8::Local<v8::ObjectTemplate> CObjectTemplateCache::Get(PyTypeObject *type)
+{
+  if (!IsSpecializable(type))
+    return Generic();
+
+  if (m_entries.size() >= m_sweep_size)
+    Sweep();
+
+  EntryMap::iterator it = m_entries.find(type);
+
+  // a new type may be allocated at the address of a released one
+  if (it != m_entries.end() && !it->second->IsAlive())
+  {
+    m_entries.erase(it);
+
+    it = m_entries.end();
+  }
+
+  if (it == m_entries.end())
+  {
+    PyObject *ref = ::PyWeakref_NewRef((PyObject *) type, NULL);
+
+    if (!ref)
+    {
+      ::PyErr_Clear();
+
+      return Generic();
+    }
+
+    m_types.push_back(py::object(py::handle<>(ref)));
+
+    EntryPtr entry(new Entry(&m_types.back()));
+
+    m_entries[type] = entry;
+
+    Build(type, entry);
+
+    it = m_entries.find(type);
+  }
+  else if (!PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG) || it->second->version != type->tp_version_tag)
+  {
+    EntryPtr entry = it->second;
+
+    if (entry->rebuilds < MAX_REBUILDS)
+    {
+      BOOST_LOG_SEV(CIsolate(m_isolate).Logger(), trace) << "type " << type->tp_name << " modified, rebuild template";
+
+      entry->rebuilds++;
+
+      Build(type, entry);
+    }
+    else if (!entry->tmpl.IsEmpty())
+    {
+      BOOST_LOG_SEV(CIsolate(m_isolate).Logger(), debug) << "type " << type->tp_name << " modified too often, use the generic template";
+
+      entry->tmpl.Reset();
+    }
+  }
+
+  const EntryPtr &entry = it->second;
+
+  if (entry->tmpl.IsEmpty())
+    return Generic();
+
+  return v8::Local<v8::FunctionTemplate>::New(m_isolate, entry->tmpl)->InstanceTemplate();
+}
+
+void CObjectTemplateCache::Build(PyTypeObject *type, EntryPtr entry)
+{
+  v8::HandleScope handle_scope(m_isolate);
+
+  entry->tmpl.Reset();
+
+  // looking up the type assigns a version tag, which will be invalidated when the type is modified
+
+  ::_PyType_Lookup(type, Intern("__class__"));
+
+  if (!PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG))
+    return;
+
+  entry->version = type->tp_version_tag;
+
+  std::vector<PyObject *> members;
+
+  PyObject *mro = type->tp_mro;
+
+  for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(mro) && members.size() < MAX_MEMBERS; i++)
+  {
+    PyObject *base = PyTuple_GET_ITEM(mro, i);
+
+    if (base == (PyObject *) &::PyBaseObject_Type || !PyType_Check(base))
+      continue;
+
+    PyObject *dict = ((PyTypeObject *) base)->tp_dict;
+
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+
+    while (dict && ::PyDict_Next(dict, &pos, &key, &value) && members.size() < MAX_MEMBERS)
+    {
+#if PY_MAJOR_VERSION < 3
+      if (!PyString_CheckExact(key))
+        continue;
+
+      std::string name(PyString_AS_STRING(key), PyString_GET_SIZE(key));
+#else
+      if (!PyUnicode_CheckExact(key))
+        continue;
+
+      std::string name(PyUnicode_AsUTF8(key));
+#endif
+
+      if (name.size() > 4 && name.compare(0, 2, "__") == 0 && name.compare(name.size() - 2, 2, "__") == 0)
+        continue;
+
+      // the constructor of prototype is the function template itself, can't be overridden by an accessor
+
+      if (name == "constructor")
+        return;
+
+      if (m_names.find(name) == m_names.end())
+      {
+        m_names[name] = py::object(py::handle<>(py::borrowed(key)));
+      }
+      else if (std::find(members.begin(), members.end(), m_names[name].ptr()) != members.end())
+      {
+        continue;
+      }
+
+      members.push_back(m_names[name].ptr());
+    }
+  }
+
+  entry->tmpl.Reset(m_isolate, CPythonObject::CreateTypeTemplate(m_isolate, entry->type, members));
+
+  BOOST_LOG_SEV(CIsolate(m_isolate).Logger(), trace) << "type " << type->tp_name << " template built with "
+                                                     << members.size() << " members";
+}
+
+void CObjectTemplateCache::Sweep(void)
+{
+  for (EntryMap::iterator it = m_entries.begin(); it != m_entries.end();)
+  {
+    if (it->second->IsAlive())
+      ++it;
+    else
+      it = m_entries.erase(it);
+  }
+
+  m_sweep_size = std::max<size_t>(MAX_MEMBERS, m_entries.size() * 2);
+
+  BOOST_LOG_SEV(CIsolate(m_isolate).Logger(), trace) << "swept template cache, " << m_entries.size() << " types alive";
+}
+
+PyObject *CObjectTemplateCache::Intern(const char *name)
+{
+  py::object &value = m_names[name];
+
+  if (value.is_none())
+  {
+#if PY_MAJOR_VERSION < 3
+    value = py::object(py::handle<>(::PyString_InternFromString(name)));
+#else
+    value = py::object(py::handle<>(::PyUnicode_InternFromString(name)));
+#endif
+  }
+
+  return value.ptr();
+}
+
+void CPropertyNameCache::Insert(py::object name, v8::Local<v8::String> str)
+{
+  if (m_py_names.find(name.ptr()) != m_py_names.end())
+    return;
+
+  EntryPtr entry(new Entry());
+
+  entry->name = name;
+  entry->str.Reset(m_isolate, str);
+  entry->hash = str->GetIdentityHash();
+  entry->referenced = false;
+
+  if (m_clock.size() < MAX_NAMES)
+  {
+    m_clock.push_back(entry);
+  }
+  else
+  {
+    // the hand clears the referenced bits until it finds a name not used since its last pass
+    while (m_clock[m_hand]->referenced)
+    {
+      m_clock[m_hand]->referenced = false;
+      m_hand = (m_hand + 1) % m_clock.size();
+    }
+
+    Evict(m_clock[m_hand]);
+
+    m_clock[m_hand] = entry;
+    m_hand = (m_hand + 1) % m_clock.size();
+  }
+
+  m_py_names.insert(std::make_pair(name.ptr(), entry));
+  m_js_names.insert(std::make_pair(entry->hash, entry));
+}
+
+void CPropertyNameCache::Evict(EntryPtr entry)
+{
+  m_py_names.erase(entry->name.ptr());
+
+  auto range = m_js_names.equal_range(entry->hash);
+
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    if (it->second == entry)
+    {
+      m_js_names.erase(it);
+
+      break;
+    }
+  }
+}
+
+v8::Local<v8::String> CPropertyNameCache::Get(py::object name)
+{
+  auto it = m_py_names.find(name.ptr());
+
+  if (it != m_py_names.end())
+  {
+    it->second->referenced = true;
+
+    return v8::Local<v8::String>::New(m_isolate, it->second->str);
+  }
+
+  const char *buf = NULL;
+  Py_ssize_t len = 0;
+
+#if PY_MAJOR_VERSION < 3
+  if (PyString_CheckExact(name.ptr()) && PyString_CHECK_INTERNED(name.ptr()))
+  {
+    buf = PyString_AS_STRING(name.ptr());
+    len = PyString_GET_SIZE(name.ptr());
+  }
+#else
+  if (PyUnicode_CheckExact(name.ptr()) && PyUnicode_CHECK_INTERNED(name.ptr()))
+  {
+    buf = ::PyUnicode_AsUTF8AndSize(name.ptr(), &len);
+
+    if (!buf)
+      py::throw_error_already_set();
+  }
+#endif
+
+  // only the interned names are worth caching, the others are mostly computed keys
+  if (!buf)
+    return DecodeUtf8(py::extract<std::string>(name)(), m_isolate);
+
+  v8::Local<v8::String> str = v8::String::NewFromUtf8(m_isolate, buf, v8::NewStringType::kInternalized, len).ToLocalChecked();
+
+  Insert(name, str);
+
+  return str;
+}
+
+py::object CPropertyNameCache::Get(v8::Local<v8::String> name)
+{
+  auto range = m_js_names.equal_range(name->GetIdentityHash());
+
+  for (auto it = range.first; it != range.second; ++it)
+  {
+    v8::Local<v8::String> str = v8::Local<v8::String>::New(m_isolate, it->second->str);
+
+    if (str == name || str->StrictEquals(name))
+    {
+      it->second->referenced = true;
+
+      return it->second->name;
+    }
+  }
+
+  v8::String::Utf8Value utf8(name);
+
+#if PY_MAJOR_VERSION < 3
+  PyObject *value = ::PyString_FromStringAndSize(*utf8, utf8.length());
+#else
+  PyObject *value = ::PyUnicode_FromStringAndSize(*utf8, utf8.length());
+#endif
+
+  if (!value)
+    py::throw_error_already_set();
+
+#if PY_MAJOR_VERSION < 3
+  ::PyString_InternInPlace(&value);
+#else
+  ::PyUnicode_InternInPlace(&value);
+#endif
+
+  py::object result(py::handle<>(value));
+
+  // the keys of the interceptors are not always internalized
+  Insert(result, v8::String::NewFromUtf8(m_isolate, *utf8, v8::NewStringType::kInternalized, utf8.length()).ToLocalChecked());
+
+  return result;
+}
+
+v8::Handle<v8::Value> CPythonObject::WrapBuffer(py::object obj)
+{
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  v8::EscapableHandleScope handle_scope(isolate);
+
+  py::object view(py::handle<>(::PyMemoryView_FromObject(obj.ptr())));
+
+  Py_buffer *buf = PyMemoryView_GET_BUFFER(view.ptr());
+
+  v8::Local<v8::ArrayBuffer> result;
+
+#ifdef SUPPORT_TRACE_LIFECYCLE
+  if (!buf->readonly && ::PyBuffer_IsContiguous(buf, 'C'))
+  {
+    // share the memory with the exporter, the memoryview holds the buffer until the ArrayBuffer is collected
+
+    result = v8::ArrayBuffer::New(isolate, buf->buf, buf->len, v8::ArrayBufferCreationMode::kExternalized);
+
+    ObjectTracer::Trace(result, new py::object(view));
+
+    return handle_scope.Escape(result);
+  }
+#endif
+
+  // the read-only or non-contiguous buffers are copied, Javascript could modify the ArrayBuffer anyway
+
+  result = v8::ArrayBuffer::New(isolate, buf->len);
+
+  if (0 != ::PyBuffer_ToContiguous(result->GetContents().Data(), buf, buf->len, 'C'))
+    py::throw_error_already_set();
+
+  return handle_scope.Escape(result);
+}
+
+CJavascriptObject::~CJavascriptObject()
+{
+  // the handles went away with a disposed isolate
+  if (m_obj.IsEmpty() || !CManagedIsolate::IsAlive(m_isolate))
+    return;
+
+  CDisposeLocker locker(m_isolate);
+
+  m_obj.Reset();
+}
+
+CJavascriptFunction::~CJavascriptFunction()
+{
+  if (!CManagedIsolate::IsAlive(m_isolate))
+    return;
+
+  CDisposeLocker locker(m_isolate);
+
+  m_self.Reset();
+}
+
+PyBufferProcs CJavascriptArrayBuffer::s_buffer_procs;
+
+void CJavascriptArrayBuffer::Expose(void)
+{
+  py::object clazz = py::class_<CJavascriptArrayBuffer, py::bases<CJavascriptObject>, boost::noncopyable>("JSArrayBuffer", py::no_init);
+
+  // Boost::Python doesn't support the buffer protocol, so just install it to the type object
+
+  memset(&s_buffer_procs, 0, sizeof(s_buffer_procs));
+
+  s_buffer_procs.bf_getbuffer = GetBuffer;
+  s_buffer_procs.bf_releasebuffer = ReleaseBuffer;
+
+  PyTypeObject *type = reinterpret_cast<PyTypeObject *>(clazz.ptr());
+
+  type->tp_as_buffer = &s_buffer_procs;
+#if PY_MAJOR_VERSION < 3
+  type->tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER;
+#endif
+}
+
+CJavascriptArrayBuffer::CJavascriptArrayBuffer(v8::Handle<v8::Object> obj)
+    : CJavascriptObject(obj), m_itemsize(1), m_shape(0), m_format("B"), m_exports(0), m_neuterable(false)
+{
+  v8::HandleScope handle_scope(v8::Isolate::GetCurrent());
+
+  if (obj->IsArrayBufferView())
+  {
+    if (obj->IsInt8Array()) { m_format = "b"; m_itemsize = 1; }
+    else if (obj->IsUint16Array()) { m_format = "H"; m_itemsize = 2; }
+    else if (obj->IsInt16Array()) { m_format = "h"; m_itemsize = 2; }
+    else if (obj->IsUint32Array()) { m_format = "I"; m_itemsize = 4; }
+    else if (obj->IsInt32Array()) { m_format = "i"; m_itemsize = 4; }
+    else if (obj->IsFloat32Array()) { m_format = "f"; m_itemsize = 4; }
+    else if (obj->IsFloat64Array()) { m_format = "d"; m_itemsize = 8; }
+  }
+}
+
+v8::Local<v8::ArrayBuffer> CJavascriptArrayBuffer::Buffer(void) const
+{
+  v8::Local<v8::Object> obj = v8::Local<v8::Object>::New(m_isolate, m_obj);
+
+  if (obj->IsArrayBuffer())
+    return v8::Local<v8::ArrayBuffer>::Cast(obj);
+
+  // Buffer() moves the on-heap backing store out of the heap, it must be called before taking the address
+  return v8::Local<v8::ArrayBufferView>::Cast(obj)->Buffer();
+}
+
+py::object CJavascriptArrayBuffer::Wrap(v8::Handle<v8::Object> obj)
+{
+  py::object buffer = CJavascriptObject::Wrap(Create<CJavascriptArrayBuffer>(obj));
+
+  return py::object(py::handle<>(::PyMemoryView_FromObject(buffer.ptr())));
+}
+
+int CJavascriptArrayBuffer::GetBuffer(PyObject *exporter, Py_buffer *view, int flags)
+{
+  py::extract<CJavascriptArrayBuffer &> extractor(exporter);
+
+  if (!extractor.check())
+  {
+    ::PyErr_SetString(::PyExc_BufferError, "not a Javascript ArrayBuffer");
+
+    return -1;
+  }
+
+  CJavascriptArrayBuffer &self = extractor();
+
+  // the contents are read again for every export, the address must still be valid
+  if (!CManagedIsolate::IsAlive(self.m_isolate))
+  {
+    ::PyErr_SetString(::PyExc_BufferError, "the isolate of the ArrayBuffer has been disposed");
+
+    return -1;
+  }
+
+  CDisposeLocker locker(self.m_isolate);
+
+  v8::HandleScope handle_scope(self.m_isolate);
+
+  v8::Local<v8::ArrayBuffer> buffer = self.Buffer();
+  v8i::Handle<v8i::JSArrayBuffer> internal = v8::Utils::OpenHandle(*buffer);
+
+  if (internal->was_neutered())
+  {
+    ::PyErr_SetString(::PyExc_BufferError, "the ArrayBuffer has been neutered");
+
+    return -1;
+  }
+
+  v8::ArrayBuffer::Contents contents = buffer->GetContents();
+
+  char *data = static_cast<char *>(contents.Data());
+  Py_ssize_t size = contents.ByteLength();
+
+  v8::Local<v8::Object> obj = v8::Local<v8::Object>::New(self.m_isolate, self.m_obj);
+
+  if (obj->IsArrayBufferView())
+  {
+    v8::Local<v8::ArrayBufferView> view = v8::Local<v8::ArrayBufferView>::Cast(obj);
+
+    data += view->ByteOffset();
+    size = view->ByteLength();
+  }
+
+  if (0 != ::PyBuffer_FillInfo(view, exporter, data, size, 0, flags))
+    return -1;
+
+  self.m_shape = size / self.m_itemsize;
+
+  if ((flags & PyBUF_FORMAT) == PyBUF_FORMAT)
+  {
+    view->format = const_cast<char *>(self.m_format);
+    view->itemsize = self.m_itemsize;
+
+    if (view->shape) view->shape = &self.m_shape;
+  }
+
+  // the memoryview keeps the address, so the buffer must not be neutered until it's released
+  if (self.m_exports++ == 0)
+  {
+    self.m_neuterable = internal->is_neuterable();
+
+    internal->set_is_neuterable(false);
+  }
+
+  return 0;
+}
+
+void CJavascriptArrayBuffer::ReleaseBuffer(PyObject *exporter, Py_buffer *view)
+{
+  CJavascriptArrayBuffer &self = py::extract<CJavascriptArrayBuffer &>(exporter)();
+
+  if (--self.m_exports > 0 || !self.m_neuterable || !CManagedIsolate::IsAlive(self.m_isolate))
+    return;
+
+  CDisposeLocker locker(self.m_isolate);
+
+  v8::HandleScope handle_scope(self.m_isolate);
+
+  v8::Utils::OpenHandle(*self.Buffer())->set_is_neuterable(true);
+}
+
+namespace
+{
+  // Convert a Javascript object graph to Python dict/list tree, the visited objects are bucketed by identity hash
+
+  class CJavascriptTreeBuilder
+  {
+    struct Visited
+    {
+      v8::Local<v8::Object> obj;
+      py::object value;
+      bool done;
+    };
+
+    typedef std::multimap<int, Visited> VisitedMap;
+
+    v8::Isolate *m_isolate;
+    v8::Local<v8::Context> m_context;
+    v8::TryCatch &m_try_catch;
+
+    bool m_cycles;
+    VisitedMap m_visited;
+
+    // a getter or Proxy trap may throw, raise it instead of touching the empty handle
+    template <typename T>
+    v8::Local<T> Check(v8::MaybeLocal<T> maybe)
+    {
+      v8::Local<T> result;
+
+      if (!maybe.ToLocal(&result))
+      {
+        CJavascriptException::ThrowIf(m_isolate, m_try_catch);
+
+        throw CJavascriptException("fail to read the Javascript object", ::PyExc_RuntimeError);
+      }
+
+      return result;
+    }
+
+    VisitedMap::iterator Visit(v8::Local<v8::Object> obj, py::object value)
+    {
+      Visited visited = {obj, value, false};
+
+      return m_visited.insert(std::make_pair(obj->GetIdentityHash(), visited));
+    }
+  public:
+    CJavascriptTreeBuilder(v8::Isolate *isolate, v8::TryCatch &try_catch, bool cycles)
+        : m_isolate(isolate), m_context(isolate->GetCurrentContext()), m_try_catch(try_catch), m_cycles(cycles)
+    {
+    }
+
+    py::object Build(v8::Local<v8::Value> value, int depth)
+    {
+      if (!value->IsObject() || value->IsDate() || value->IsFunction() ||
+          value->IsStringObject() || value->IsNumberObject() || value->IsBooleanObject() ||
+          value->IsArrayBuffer() || value->IsArrayBufferView())
+        return CJavascriptObject::Wrap(value);
+
+      v8::Local<v8::Object> obj = value.As<v8::Object>();
+
+      if (CPythonObject::IsWrapped(obj))
+        return CPythonObject::Unwrap(obj);
+
+      if (depth == 0)
+        return CJavascriptObject::Wrap(obj);
+
+      std::pair<VisitedMap::iterator, VisitedMap::iterator> range = m_visited.equal_range(obj->GetIdentityHash());
+
+      for (VisitedMap::iterator it = range.first; it != range.second; it++)
+      {
+        if (it->second.obj == obj)
+        {
+          if (!it->second.done && !m_cycles)
+            throw CJavascriptException("cyclic object value", ::PyExc_ValueError);
+
+          return it->second.value;
+        }
+      }
+
+      VisitedMap::iterator visited;
+
+      if (obj->IsArray())
+      {
+        v8::Local<v8::Array> array = obj.As<v8::Array>();
+
+        py::list items;
+
+        visited = Visit(obj, items);
+
+        for (uint32_t i = 0; i < array->Length(); i++)
+        {
+          items.append(Build(Check(array->Get(m_context, i)), depth - 1));
+        }
+      }
+      else
+      {
+        py::dict items;
+
+        visited = Visit(obj, items);
+
+        v8::Local<v8::Array> keys = Check(obj->GetPropertyNames(m_context));
+
+        for (uint32_t i = 0; i < keys->Length(); i++)
+        {
+          v8::Local<v8::Value> key = Check(keys->Get(m_context, i));
+
+          v8::String::Utf8Value name(key);
+
+          items[py::str(*name, name.length())] = Build(Check(obj->Get(m_context, key)), depth - 1);
+        }
+      }
+
+      visited->second.done = true;
+
+      return visited->second.value;
+    }
+  };
+
+  // Convert a Python dict/list/tuple tree to Javascript objects and arrays, the shared references are kept
+
+  class CPythonTreeBuilder
+  {
+    v8::Isolate *m_isolate;
+
+    typedef std::map<PyObject *, v8::Local<v8::Value> > VisitedMap;
+
+    VisitedMap m_visited;
+  public:
+    CPythonTreeBuilder(v8::Isolate *isolate) : m_isolate(isolate) {}
+
+    v8::Local<v8::Value> Build(py::object obj, int depth)
+    {
+      bool is_dict = PyDict_Check(obj.ptr()), is_list = PyList_Check(obj.ptr()) || PyTuple_Check(obj.ptr());
+
+      if (depth == 0 || !(is_dict || is_list))
+        return CPythonObject::Wrap(obj);
+
+      VisitedMap::const_iterator it = m_visited.find(obj.ptr());
+
+      if (it != m_visited.end())
+        return it->second;
+
+      if (is_dict)
+      {
+        v8::Local<v8::Object> result = v8::Object::New(m_isolate);
+
+        m_visited[obj.ptr()] = result;
+
+        PyObject *key, *value;
+        Py_ssize_t pos = 0;
+
+        while (::PyDict_Next(obj.ptr(), &pos, &key, &value))
+        {
+          py::object name(py::handle<>(py::borrowed(key)));
+
+          if (!PyBytes_Check(key) && !PyUnicode_Check(key))
+            name = py::str(name);
+
+          result->Set(ToString(name, m_isolate), Build(py::object(py::handle<>(py::borrowed(value))), depth - 1));
+        }
+
+        return result;
+      }
+
+      Py_ssize_t len = ::PySequence_Size(obj.ptr());
+
+      v8::Local<v8::Array> result = v8::Array::New(m_isolate, (int) len);
+
+      m_visited[obj.ptr()] = result;
+
+      for (Py_ssize_t i = 0; i < len; i++)
+      {
+        py::object item(py::handle<>(::PySequence_GetItem(obj.ptr(), i)));
+
+        result->Set((uint32_t) i, Build(item, depth - 1));
+      }
+
+      return result;
+    }
+  };
+}
+
+v8::Handle<v8::Value> CPythonObject::WrapDeep(py::object obj, int depth)
+{
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  v8::EscapableHandleScope handle_scope(isolate);
+
+  CPythonGIL python_gil;
+
+  return handle_scope.Escape(CPythonTreeBuilder(isolate).Build(obj, depth));
+}
+
+py::object CJavascriptObject::ToPython(int depth, bool cycles)
+{
+  CHECK_V8_CONTEXT();
+
+  v8::HandleScope handle_scope(v8::Isolate::GetCurrent());
+  CPythonGIL python_gil;
+
+  TERMINATE_EXECUTION_CHECK(py::object());
+
+  if (m_obj.IsEmpty())
+  {
+    ILazyObject *pLazyObject = dynamic_cast<ILazyObject *>(this);
+
+    if (pLazyObject)
+      pLazyObject->LazyConstructor();
+  }
+
+  v8::TryCatch try_catch;
+
+  py::object result = CJavascriptTreeBuilder(v8::Isolate::GetCurrent(), try_catch, cycles).Build(Object(), depth);
 
-    result = v8::Date::New(v8::Isolate::GetCurrent(), ((double)mktime(&ts)) * 1000 + ms / 1000);
-  }
-  else if (PyTime_CheckExact(obj.ptr()))
-  {
-    tm ts = {0};
+  if (try_catch.HasCaught())
+    CJavascriptException::ThrowIf(v8::Isolate::GetCurrent(), try_catch);
 
-    ts.tm_hour = PyDateTime_TIME_GET_HOUR(obj.ptr()) - 1;
-    ts.tm_min = PyDateTime_TIME_GET_MINUTE(obj.ptr());
-    ts.tm_sec = PyDateTime_TIME_GET_SECOND(obj.ptr());
+  return result;
+}
 
-    int ms = PyDateTime_TIME_GET_MICROSECOND(obj.ptr());
+py::object CJavascriptObject::ToJSON(void)
+{
+  CHECK_V8_CONTEXT();
 
-    result = v8::Date::New(v8::Isolate::GetCurrent(), ((double)mktime(&ts)) * 1000 + ms / 1000);
-  }
-  else if (PyCFunction_Check(obj.ptr()) || PyFunction_Check(obj.ptr()) ||
-           PyMethod_Check(obj.ptr()) || PyType_Check(obj.ptr()))
-  {
-    v8::Handle<v8::FunctionTemplate> func_tmpl = v8::FunctionTemplate::New(v8::Isolate::GetCurrent());
-    py::object *object = new py::object(obj);
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
 
-    func_tmpl->SetCallHandler(Caller, v8::External::New(v8::Isolate::GetCurrent(), object));
+  v8::HandleScope handle_scope(isolate);
 
-    if (PyType_Check(obj.ptr()))
-    {
-      v8::Handle<v8::String> cls_name = v8::String::NewFromUtf8(v8::Isolate::GetCurrent(), py::extract<const char *>(obj.attr("__name__"))());
+  TERMINATE_EXECUTION_CHECK(py::object());
 
-      func_tmpl->SetClassName(cls_name);
-    }
+  v8::TryCatch try_catch(isolate);
 
-    result = func_tmpl->GetFunction();
+  v8::MaybeLocal<v8::String> json = v8::JSON::Stringify(isolate->GetCurrentContext(), Object());
 
-#ifdef SUPPORT_TRACE_LIFECYCLE
-    if (!result.IsEmpty())
-      ObjectTracer::Trace(result, object);
-#endif
-  }
-  else
-  {
-    v8::Handle<v8::Object> instance = CIsolate::Current().ObjectTemplate()->NewInstance();
+  if (json.IsEmpty())
+    CJavascriptException::ThrowIf(isolate, try_catch);
 
-    if (!instance.IsEmpty())
-    {
-      py::object *object = new py::object(obj);
+  return ToBytes(json.ToLocalChecked());
+}
 
-      instance->SetInternalField(0, v8::External::New(v8::Isolate::GetCurrent(), object));
+py::object CJavascriptObject::FromPython(py::object obj, int depth)
+{
+  CHECK_V8_CONTEXT();
 
-#ifdef SUPPORT_TRACE_LIFECYCLE
-      ObjectTracer::Trace(instance, object);
-#endif
-    }
+  v8::HandleScope handle_scope(v8::Isolate::GetCurrent());
 
-    result = instance;
-  }
+  v8::TryCatch try_catch;
+
+  v8::Handle<v8::Value> result = CPythonObject::WrapDeep(obj, depth);
 
   if (result.IsEmpty())
     CJavascriptException::ThrowIf(v8::Isolate::GetCurrent(), try_catch);
 
-  return handle_scope.Escape(result);
+  return CJavascriptObject::Wrap(result);
 }
 
 void CJavascriptObject::CheckAttr(v8::Handle<v8::String> name) const
@@ -987,12 +2005,12 @@ void CJavascriptObject::CheckAttr(v8::Handle<v8::String> name) const
   }
 }
 
-py::object CJavascriptObject::GetAttr(const std::string &name)
+py::object CJavascriptObject::GetAttr(py::object name)
 {
 #ifdef SUPPORT_PROBES
   if (WRAPPER_JS_OBJECT_GETATTR_ENABLED())
   {
-    WRAPPER_JS_OBJECT_GETATTR(&m_obj, name.c_str());
+    WRAPPER_JS_OBJECT_GETATTR(&m_obj, py::extract<std::string>(name)().c_str());
   }
 #endif
 
@@ -1002,7 +2020,7 @@ py::object CJavascriptObject::GetAttr(const std::string &name)
 
   v8::TryCatch try_catch;
 
-  v8::Handle<v8::String> attr_name = DecodeUtf8(name);
+  v8::Handle<v8::String> attr_name = CIsolate::Current().PropertyNames().Get(name);
 
   CheckAttr(attr_name);
 
@@ -1014,12 +2032,12 @@ py::object CJavascriptObject::GetAttr(const std::string &name)
   return CJavascriptObject::Wrap(attr_value, Object());
 }
 
-void CJavascriptObject::SetAttr(const std::string &name, py::object value)
+void CJavascriptObject::SetAttr(py::object name, py::object value)
 {
 #ifdef SUPPORT_PROBES
   if (WRAPPER_JS_OBJECT_SETATTR_ENABLED())
   {
-    WRAPPER_JS_OBJECT_SETATTR(&m_obj, name.c_str(), value.ptr());
+    WRAPPER_JS_OBJECT_SETATTR(&m_obj, py::extract<std::string>(name)().c_str(), value.ptr());
   }
 #endif
 
@@ -1029,7 +2047,7 @@ void CJavascriptObject::SetAttr(const std::string &name, py::object value)
 
   v8::TryCatch try_catch;
 
-  v8::Handle<v8::String> attr_name = DecodeUtf8(name);
+  v8::Handle<v8::String> attr_name = CIsolate::Current().PropertyNames().Get(name);
   v8::Handle<v8::Value> attr_obj = CPythonObject::Wrap(value);
 
   if (Object()->Has(attr_name))
@@ -1040,12 +2058,12 @@ void CJavascriptObject::SetAttr(const std::string &name, py::object value)
   if (!Object()->Set(attr_name, attr_obj))
     CJavascriptException::ThrowIf(v8::Isolate::GetCurrent(), try_catch);
 }
-void CJavascriptObject::DelAttr(const std::string &name)
+void CJavascriptObject::DelAttr(py::object name)
 {
 #ifdef SUPPORT_PROBES
   if (WRAPPER_JS_OBJECT_DELATTR_ENABLED())
   {
-    WRAPPER_JS_OBJECT_DELATTR(&m_obj, name.c_str());
+    WRAPPER_JS_OBJECT_DELATTR(&m_obj, py::extract<std::string>(name)().c_str());
   }
 #endif
 
@@ -1055,7 +2073,7 @@ void CJavascriptObject::DelAttr(const std::string &name)
 
   v8::TryCatch try_catch;
 
-  v8::Handle<v8::String> attr_name = DecodeUtf8(name);
+  v8::Handle<v8::String> attr_name = CIsolate::Current().PropertyNames().Get(name);
 
   CheckAttr(attr_name);
 
@@ -1103,7 +2121,7 @@ CJavascriptObjectPtr CJavascriptObject::Clone(void)
 
   v8::HandleScope handle_scope(v8::Isolate::GetCurrent());
 
-  return CJavascriptObjectPtr(new CJavascriptObject(Object()->Clone()));
+  return Create<CJavascriptObject>(Object()->Clone());
 }
 
 bool CJavascriptObject::Contains(const std::string &name)
@@ -1131,6 +2149,15 @@ bool CJavascriptObject::Equals(CJavascriptObjectPtr other) const
   return other.get() && Object()->Equals(other->Object());
 }
 
+py::object CJavascriptObject::GetContext(void) const
+{
+  v8::HandleScope handle_scope(v8::Isolate::GetCurrent());
+
+  CContextPtr context(new CContext(Object()->CreationContext()));
+
+  return py::object(py::handle<>(py::converter::shared_ptr_to_python<CContext>(context)));
+}
+
 void CJavascriptObject::Dump(std::ostream &os) const
 {
   CHECK_V8_CONTEXT();
@@ -1213,18 +2240,12 @@ py::object CJavascriptObject::Wrap(v8::Handle<v8::Value> value, v8::Handle<v8::O
 
   if (value->IsInt32())
     return py::object(value->Int32Value());
+  if (value->IsUint32())
+    return py::object(py::handle<>(IntegerFromLongLong(value->Uint32Value())));
   if (value->IsString())
-  {
-    v8::String::Utf8Value str(v8::Handle<v8::String>::Cast(value));
-
-    return py::str(*str, str.length());
-  }
+    return ToStr(value.As<v8::String>());
   if (value->IsStringObject())
-  {
-    v8::String::Utf8Value str(value.As<v8::StringObject>()->ValueOf());
-
-    return py::str(*str, str.length());
-  }
+    return ToStr(value.As<v8::StringObject>()->ValueOf());
   if (value->IsBoolean())
   {
     return py::object(py::handle<>(py::borrowed(value->BooleanValue() ? Py_True : Py_False)));
@@ -1235,7 +2256,14 @@ py::object CJavascriptObject::Wrap(v8::Handle<v8::Value> value, v8::Handle<v8::O
   }
   if (value->IsNumber())
   {
-    return py::object(py::handle<>(::PyFloat_FromDouble(value->NumberValue())));
+    double n = value->NumberValue();
+
+    // the int32 values were already served above, only the integral numbers beyond them and within the
+    // safe range (e.g. the 64-bit ids) become ints, so the results of the arithmetic keep their types
+    if (n == floor(n) && fabs(n) > INT32_MAX && fabs(n) <= MAX_SAFE_INTEGER)
+      return py::object(py::handle<>(IntegerFromLongLong(static_cast<long long>(n))));
+
+    return py::object(py::handle<>(::PyFloat_FromDouble(n)));
   }
   if (value->IsNumberObject())
   {
@@ -1269,27 +2297,35 @@ py::object CJavascriptObject::Wrap(v8::Handle<v8::Object> obj, v8::Handle<v8::Ob
   {
     v8::Handle<v8::Array> array = v8::Handle<v8::Array>::Cast(obj);
 
-    return Wrap(new CJavascriptArray(array));
+    return Wrap(Create<CJavascriptArray>(array));
   }
   else if (CPythonObject::IsWrapped(obj))
   {
     return CPythonObject::Unwrap(obj);
   }
+  else if (obj->IsArrayBuffer() || obj->IsArrayBufferView())
+  {
+    return CJavascriptArrayBuffer::Wrap(obj);
+  }
   else if (obj->IsFunction())
   {
-    return Wrap(new CJavascriptFunction(self, v8::Handle<v8::Function>::Cast(obj)));
+    return Wrap(Create<CJavascriptFunction>(self, v8::Handle<v8::Function>::Cast(obj)));
+  }
+  else if (obj->IsPromise())
+  {
+    return Wrap(Create<CJavascriptPromise>(v8::Handle<v8::Promise>::Cast(obj)));
   }
 
-  return Wrap(new CJavascriptObject(obj));
+  return Wrap(Create<CJavascriptObject>(obj));
 }
 
-py::object CJavascriptObject::Wrap(CJavascriptObject *obj)
+py::object CJavascriptObject::Wrap(CJavascriptObjectPtr obj)
 {
   CPythonGIL python_gil;
 
   TERMINATE_EXECUTION_CHECK(py::object())
 
-  return py::object(py::handle<>(boost::python::converter::shared_ptr_to_python<CJavascriptObject>(CJavascriptObjectPtr(obj))));
+  return py::object(py::handle<>(boost::python::converter::shared_ptr_to_python<CJavascriptObject>(obj)));
 }
 
 void CJavascriptArray::LazyConstructor(void)
@@ -1645,15 +2681,21 @@ py::object CJavascriptFunction::Call(v8::Handle<v8::Object> self, py::list args,
 
   v8::Handle<v8::Value> result;
 
-  Py_BEGIN_ALLOW_THREADS
+  CHeapMonitor::Scope heap_scope(v8::Isolate::GetCurrent());
+
+  {
+    CAllowThreads allow_threads;
+    v8::MicrotasksScope microtasks(v8::Isolate::GetCurrent(), v8::MicrotasksScope::kRunMicrotasks);
 
-      result = func->Call(
-          self.IsEmpty() ? v8::Isolate::GetCurrent()->GetCurrentContext()->Global() : self,
-          params.size(), params.empty() ? NULL : &params[0]);
+    result = func->Call(
+        self.IsEmpty() ? v8::Isolate::GetCurrent()->GetCurrentContext()->Global() : self,
+        params.size(), params.empty() ? NULL : &params[0]);
+  }
 
-  Py_END_ALLOW_THREADS
+  heap_scope.Check(result.IsEmpty());
 
-      if (result.IsEmpty()) CJavascriptException::ThrowIf(v8::Isolate::GetCurrent(), try_catch);
+  if (result.IsEmpty())
+    CJavascriptException::ThrowIf(v8::Isolate::GetCurrent(), try_catch);
 
   return CJavascriptObject::Wrap(result);
 }
@@ -1682,13 +2724,19 @@ py::object CJavascriptFunction::CreateWithArgs(CJavascriptFunctionPtr proto, py:
 
   v8::Handle<v8::Object> result;
 
-  Py_BEGIN_ALLOW_THREADS
+  CHeapMonitor::Scope heap_scope(v8::Isolate::GetCurrent());
+
+  {
+    CAllowThreads allow_threads;
+    v8::MicrotasksScope microtasks(v8::Isolate::GetCurrent(), v8::MicrotasksScope::kRunMicrotasks);
 
-      result = func->NewInstance(params.size(), params.empty() ? NULL : &params[0]);
+    result = func->NewInstance(params.size(), params.empty() ? NULL : &params[0]);
+  }
 
-  Py_END_ALLOW_THREADS
+  heap_scope.Check(result.IsEmpty());
 
-      if (result.IsEmpty()) CJavascriptException::ThrowIf(v8::Isolate::GetCurrent(), try_catch);
+  if (result.IsEmpty())
+    CJavascriptException::ThrowIf(v8::Isolate::GetCurrent(), try_catch);
 
   size_t kwds_count = ::PyMapping_Size(kwds.ptr());
   py::list items = kwds.items();
@@ -1733,6 +2781,153 @@ py::object CJavascriptFunction::Invoke(py::list args, py::dict kwds)
   return Call(Self(), args, kwds);
 }
 
+py::list CJavascriptFunction::Map(py::object iterable, size_t chunk, bool collect_errors)
+{
+  return Batch(iterable, chunk, collect_errors, false);
+}
+
+py::list CJavascriptFunction::CallMany(py::object args, bool collect_errors)
+{
+  // the args may be any iterable, e.g. a generator, so collect them first to call them in one chunk
+  py::object seq(py::handle<>(::PySequence_Fast(args.ptr(), "args must be an iterable")));
+
+  Py_ssize_t len = PySequence_Fast_GET_SIZE(seq.ptr());
+
+  return Batch(seq, len > 0 ? len : 1, collect_errors, true);
+}
+
+py::list CJavascriptFunction::Batch(py::object iterable, size_t chunk, bool collect_errors, bool spread)
+{
+  CHECK_V8_CONTEXT();
+
+  if (chunk == 0)
+    throw CJavascriptException("chunk size must be positive", ::PyExc_ValueError);
+
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  py::object iter(py::handle<>(::PyObject_GetIter(iterable.ptr())));
+  py::list results;
+
+  // reused across chunks, each item's arguments are params[offsets[i]..offsets[i+1])
+  std::vector<v8::Handle<v8::Value>> params, values;
+  std::vector<size_t> offsets;
+
+  bool exhausted = false;
+
+  while (!exhausted)
+  {
+    v8::HandleScope handle_scope(isolate);
+
+    v8::Handle<v8::Function> func = v8::Handle<v8::Function>::Cast(Object());
+    v8::Handle<v8::Object> self = Self();
+    v8::Handle<v8::Object> recv = self.IsEmpty() ? isolate->GetCurrentContext()->Global() : self;
+
+    params.clear();
+    offsets.clear();
+
+    while (offsets.size() < chunk)
+    {
+      PyObject *next = ::PyIter_Next(iter.ptr());
+
+      if (!next)
+      {
+        if (::PyErr_Occurred()) py::throw_error_already_set();
+
+        exhausted = true;
+        break;
+      }
+
+      py::object item(py::handle<>(next));
+
+      offsets.push_back(params.size());
+
+      if (spread || PyTuple_Check(next))
+      {
+        py::object seq(py::handle<>(::PySequence_Fast(next, "arguments must be a sequence")));
+        Py_ssize_t argc = PySequence_Fast_GET_SIZE(seq.ptr());
+
+        for (Py_ssize_t i = 0; i < argc; i++)
+        {
+          params.push_back(CPythonObject::Wrap(py::object(py::handle<>(py::borrowed(PySequence_Fast_GET_ITEM(seq.ptr(), i))))));
+        }
+      }
+      else
+      {
+        params.push_back(CPythonObject::Wrap(item));
+      }
+    }
+
+    size_t count = offsets.size();
+
+    if (count == 0) break;
+
+    offsets.push_back(params.size());
+    values.assign(count, v8::Handle<v8::Value>());
+
+    v8::TryCatch try_catch(isolate);
+
+    CHeapMonitor::Scope heap_scope(isolate);
+
+    size_t idx = 0, wrapped = 0;
+
+    while (idx < count)
+    {
+      {
+        CAllowThreads allow_threads;
+        v8::MicrotasksScope microtasks(isolate, v8::MicrotasksScope::kRunMicrotasks);
+
+        for (; idx < count; idx++)
+        {
+          size_t argc = offsets[idx + 1] - offsets[idx];
+
+          values[idx] = func->Call(recv, argc, argc ? &params[offsets[idx]] : NULL);
+
+          if (values[idx].IsEmpty()) break;
+        }
+      }
+
+      heap_scope.Check(idx < count);
+
+      for (; wrapped < idx; wrapped++)
+      {
+        results.append(CJavascriptObject::Wrap(values[wrapped]));
+      }
+
+      if (idx == count) break;
+
+      if (!try_catch.CanContinue())
+        throw CJavascriptException("script execution has been terminated", ::PyExc_RuntimeError);
+
+      if (!collect_errors) CJavascriptException::ThrowIf(isolate, try_catch);
+
+      try
+      {
+        CJavascriptException::ThrowIf(isolate, try_catch);
+      }
+      catch (const CJavascriptException &ex)
+      {
+        ExceptionTranslator::Translate(ex);
+
+        PyObject *type = NULL, *value = NULL, *traceback = NULL;
+
+        ::PyErr_Fetch(&type, &value, &traceback);
+        ::PyErr_NormalizeException(&type, &value, &traceback);
+
+        results.append(value ? py::object(py::handle<>(value)) : py::object());
+
+        Py_XDECREF(type);
+        Py_XDECREF(traceback);
+      }
+
+      try_catch.Reset();
+
+      wrapped = ++idx;
+    }
+  }
+
+  return results;
+}
+
 const std::string CJavascriptFunction::GetName(void) const
 {
   CHECK_V8_CONTEXT();
@@ -1830,8 +3025,162 @@ py::object CJavascriptFunction::GetOwner(void) const
   return CJavascriptObject::Wrap(Self());
 }
 
+v8::Promise::PromiseState CJavascriptPromise::GetState(void) const
+{
+  v8::HandleScope handle_scope(v8::Isolate::GetCurrent());
+
+  return Object().As<v8::Promise>()->State();
+}
+
+py::object CJavascriptPromise::GetResult(void) const
+{
+  CHECK_V8_CONTEXT();
+
+  v8::HandleScope handle_scope(v8::Isolate::GetCurrent());
+
+  v8::Local<v8::Promise> promise = Object().As<v8::Promise>();
+
+  if (promise->State() == v8::Promise::kPending)
+    throw CJavascriptException("promise is still pending", ::PyExc_RuntimeError);
+
+  return CJavascriptObject::Wrap(promise->Result());
+}
+
+py::object CJavascriptPromise::Then(py::object on_fulfilled, py::object on_rejected)
+{
+  CHECK_V8_CONTEXT();
+
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  v8::HandleScope handle_scope(isolate);
+
+  v8::TryCatch try_catch(isolate);
+
+  v8::Local<v8::Context> context = isolate->GetCurrentContext();
+
+  // V8 only exposes the single handler Promise::Then, call the builtin then for the (onFulfilled, onRejected) form
+  v8::Local<v8::Value> then;
+
+  if (!Object()->Get(context, v8::String::NewFromUtf8(isolate, "then")).ToLocal(&then) || !then->IsFunction())
+  {
+    CJavascriptException::ThrowIf(isolate, try_catch);
+
+    throw CJavascriptException("promise has no then method", ::PyExc_TypeError);
+  }
+
+  v8::Local<v8::Value> args[] = {
+      on_fulfilled.is_none() ? v8::Undefined(isolate).As<v8::Value>() : CPythonObject::Wrap(on_fulfilled),
+      on_rejected.is_none() ? v8::Undefined(isolate).As<v8::Value>() : CPythonObject::Wrap(on_rejected)};
+
+  v8::Local<v8::Value> result;
+
+  CHeapMonitor::Scope heap_scope(isolate);
+
+  {
+    CAllowThreads allow_threads;
+    v8::MicrotasksScope microtasks(isolate, v8::MicrotasksScope::kRunMicrotasks);
+
+    if (!then.As<v8::Function>()->Call(context, Object(), 2, args).ToLocal(&result))
+      result.Clear();
+  }
+
+  heap_scope.Check(result.IsEmpty());
+
+  if (result.IsEmpty())
+    CJavascriptException::ThrowIf(isolate, try_catch);
+
+  return CJavascriptObject::Wrap(result);
+}
+
 #ifdef SUPPORT_TRACE_LIFECYCLE
 
+void CLivingMap::Grow(void)
+{
+  std::vector<slot_t> slots(m_slots.size() * 2);
+
+  m_slots.swap(slots);
+
+  for (size_t i = 0; i < slots.size(); i++)
+  {
+    if (!slots[i].first) continue;
+
+    size_t j = Index(slots[i].first);
+
+    while (m_slots[j].first) j = (j + 1) & (m_slots.size() - 1);
+
+    m_slots[j] = slots[i];
+  }
+}
+
+void CLivingMap::Insert(PyObject *key, ObjectTracer *tracer)
+{
+  // keep the load factor below 3/4
+  if ((m_size + 1) * 4 > m_slots.size() * 3) Grow();
+
+  size_t i = Index(key);
+
+  while (m_slots[i].first)
+  {
+    if (m_slots[i].first == key) return;
+
+    i = (i + 1) & (m_slots.size() - 1);
+  }
+
+  m_slots[i] = slot_t(key, tracer);
+  m_size++;
+}
+
+void CLivingMap::Erase(PyObject *key, ObjectTracer *tracer)
+{
+  size_t mask = m_slots.size() - 1, i = Index(key);
+
+  while (m_slots[i].first != key)
+  {
+    if (!m_slots[i].first) return;
+
+    i = (i + 1) & mask;
+  }
+
+  if (m_slots[i].second != tracer) return;
+
+  // shift the following slots of the cluster back, so no tombstone is needed
+  for (size_t j = (i + 1) & mask; m_slots[j].first; j = (j + 1) & mask)
+  {
+    size_t k = Index(m_slots[j].first);
+
+    // the slot can't move before its home position k
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+
+    m_slots[i] = m_slots[j];
+    i = j;
+  }
+
+  m_slots[i] = slot_t(NULL, NULL);
+  m_size--;
+}
+
+struct ObjectTracerPoolTag
+{
+};
+
+typedef boost::singleton_pool<ObjectTracerPoolTag, sizeof(ObjectTracer)> ObjectTracerPool;
+
+void *ObjectTracer::operator new(size_t size)
+{
+  assert(size == sizeof(ObjectTracer));
+
+  void *p = ObjectTracerPool::malloc();
+
+  if (!p) throw std::bad_alloc();
+
+  return p;
+}
+
+void ObjectTracer::operator delete(void *p)
+{
+  if (p) ObjectTracerPool::free(p);
+}
+
 ObjectTracer::ObjectTracer(v8::Handle<v8::Value> handle, py::object *object)
     : m_handle(v8::Isolate::GetCurrent(), handle),
       m_object(object), m_living(GetLivingMapping())
@@ -1846,7 +3195,7 @@ ObjectTracer::~ObjectTracer()
 
     Dispose();
 
-    m_living->erase(m_object->ptr());
+    m_living->Erase(m_object->ptr(), this);
   }
 }
 
@@ -1869,15 +3218,19 @@ void ObjectTracer::Trace(void)
 {
   m_handle.SetWeak(this, WeakCallback, v8::WeakCallbackType::kFinalizer);
 
-  m_living->insert(std::make_pair(m_object->ptr(), this));
+  m_living->Insert(m_object->ptr(), this);
 }
 
 void ObjectTracer::WeakCallback(const v8::WeakCallbackInfo<ObjectTracer> &data)
 {
+  // the GC may be triggered while the GIL was released, e.g. running script
+
+  CPythonGIL python_gil;
+
   std::auto_ptr<ObjectTracer> tracer(data.GetParameter());
 }
 
-LivingMap *ObjectTracer::GetLivingMapping(v8::Isolate *isolate)
+CLivingMap *ObjectTracer::GetLivingMapping(v8::Isolate *isolate)
 {
   if (!isolate)
     isolate = v8::Isolate::GetCurrent();
@@ -1885,45 +3238,41 @@ LivingMap *ObjectTracer::GetLivingMapping(v8::Isolate *isolate)
   v8::HandleScope handle_scope(isolate);
 
   v8::Handle<v8::Context> ctxt = isolate->GetCurrentContext();
-  v8::Handle<v8::Private> key = v8::Private::New(isolate, v8::String::NewFromUtf8(isolate, "__living__"));
-
-  v8::MaybeLocal<v8::Value> value = ctxt->Global()->GetPrivate(ctxt, key);
 
-  if (!value.IsEmpty())
-  {
-    LivingMap *living = (LivingMap *)v8::External::Cast(*value.ToLocalChecked())->Value();
+  CLivingMap *living = CContext::GetLivingMap(ctxt);
 
-    if (living)
-      return living;
-  }
+  if (living)
+    return living;
 
-  std::auto_ptr<LivingMap> living(new LivingMap());
+  std::auto_ptr<CLivingMap> created(new CLivingMap());
 
-  ctxt->Global()->SetPrivate(ctxt, key, v8::External::New(isolate, living.get()));
+  CContext::SetLivingMap(ctxt, created.get());
 
-  ContextTracer::Trace(ctxt, living.get());
+  ContextTracer::Trace(ctxt, created.get());
 
-  return living.release();
+  return created.release();
 }
 
 v8::Handle<v8::Value> ObjectTracer::FindCache(py::object obj)
 {
-  LivingMap *living = GetLivingMapping();
+  v8::Isolate *isolate = v8::Isolate::GetCurrent();
+
+  CLivingMap *living = CContext::GetLivingMap(isolate->GetCurrentContext());
 
   if (living)
   {
-    LivingMap::const_iterator it = living->find(obj.ptr());
+    ObjectTracer *tracer = living->Find(obj.ptr());
 
-    if (it != living->end())
+    if (tracer)
     {
-      return v8::Local<v8::Value>::New(v8::Isolate::GetCurrent(), it->second->m_handle);
+      return v8::Local<v8::Value>::New(isolate, tracer->m_handle);
     }
   }
 
   return v8::Handle<v8::Value>();
 }
 
-ContextTracer::ContextTracer(v8::Handle<v8::Context> ctxt, LivingMap *living)
+ContextTracer::ContextTracer(v8::Handle<v8::Context> ctxt, CLivingMap *living)
     : m_ctxt(v8::Isolate::GetCurrent(), ctxt), m_living(living)
 {
 }
@@ -1932,19 +3281,19 @@ ContextTracer::~ContextTracer(void)
 {
   v8::Local<v8::Context> ctxt = m_ctxt.Get(v8::Isolate::GetCurrent());
 
-  v8::Handle<v8::Private> key = v8::Private::New(ctxt->GetIsolate(), v8::String::NewFromUtf8(ctxt->GetIsolate(), "__living__"));
+  CContext::SetLivingMap(ctxt, NULL);
 
-  ctxt->Global()->DeletePrivate(ctxt, key);
+  m_living->ForEach(DisposeTracer);
+}
 
-  for (LivingMap::const_iterator it = m_living->begin(); it != m_living->end(); it++)
-  {
-    std::auto_ptr<ObjectTracer> tracer(it->second);
+void ContextTracer::DisposeTracer(ObjectTracer *tracer)
+{
+  std::auto_ptr<ObjectTracer> holder(tracer);
 
-    tracer->Dispose();
-  }
+  holder->Dispose();
 }
 
-void ContextTracer::Trace(v8::Handle<v8::Context> ctxt, LivingMap *living)
+void ContextTracer::Trace(v8::Handle<v8::Context> ctxt, CLivingMap *living)
 {
   ContextTracer *tracer = new ContextTracer(ctxt, living);
 
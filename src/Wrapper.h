@@ -1,9 +1,16 @@
 #pragma once
 
 #include <map>
+#include <list>
+#include <unordered_map>
+#include <vector>
 #include <sstream>
+#include <utility>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/pool/pool_alloc.hpp>
 #include <boost/iterator/iterator_facade.hpp>
 
 #include "Exception.h"
@@ -21,6 +28,11 @@ struct CWrapper
 
 class CPythonObject
 {
+public:
+  // the wrapper class id of the wrapped Python objects, labelled by their type name in the heap snapshots
+  static const uint16_t WRAPPER_CLASS_ID = 0x5059;
+
+private:
   static void NamedGetter(v8::Local<v8::String> prop, const v8::PropertyCallbackInfo<v8::Value> &info);
   static void NamedSetter(v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::PropertyCallbackInfo<v8::Value> &info);
   static void NamedQuery(v8::Local<v8::String> prop, const v8::PropertyCallbackInfo<v8::Integer> &info);
@@ -33,25 +45,161 @@ class CPythonObject
   static void IndexedDeleter(uint32_t index, const v8::PropertyCallbackInfo<v8::Boolean> &info);
   static void IndexedEnumerator(const v8::PropertyCallbackInfo<v8::Array> &info);
 
+  template <typename T, void (*callback)(v8::Local<v8::String>, const v8::PropertyCallbackInfo<T> &)>
+  static void NamedAdapter(v8::Local<v8::Name> prop, const v8::PropertyCallbackInfo<T> &info)
+  {
+    if (prop->IsString()) callback(v8::Local<v8::String>::Cast(prop), info);
+  }
+  static void NamedSetterAdapter(v8::Local<v8::Name> prop, v8::Local<v8::Value> value, const v8::PropertyCallbackInfo<v8::Value> &info)
+  {
+    if (prop->IsString()) NamedSetter(v8::Local<v8::String>::Cast(prop), value, info);
+  }
+
+  static void MemberGetter(v8::Local<v8::String> prop, const v8::PropertyCallbackInfo<v8::Value> &info);
+  static void MemberSetter(v8::Local<v8::String> prop, v8::Local<v8::Value> value, const v8::PropertyCallbackInfo<void> &info);
+
   static void Caller(const v8::FunctionCallbackInfo<v8::Value> &info);
 
+  static void SetAttribute(py::object obj, py::object name, py::object value);
+
 #ifdef SUPPORT_TRACE_LIFECYCLE
   static void DisposeCallback(v8::Persistent<v8::Value> object, void *parameter);
 #endif
 protected:
   static void SetupObjectTemplate(v8::Isolate *isolate, v8::Handle<v8::ObjectTemplate> clazz);
+
+  static v8::Handle<v8::Value> WrapInteger(int64_t value);
+  static v8::Handle<v8::Value> WrapLong(PyObject *obj);
   static v8::Handle<v8::Value> WrapInternal(py::object obj);
+  static v8::Handle<v8::Value> WrapBuffer(py::object obj);
 
 public:
   static v8::Handle<v8::ObjectTemplate> CreateObjectTemplate(v8::Isolate *isolate);
+  static v8::Handle<v8::FunctionTemplate> CreateTypeTemplate(v8::Isolate *isolate, py::object *type,
+                                                             const std::vector<PyObject *> &members);
   static bool IsWrapped(v8::Handle<v8::Object> obj);
   static v8::Handle<v8::Value> Wrap(py::object obj);
+  static v8::Handle<v8::Value> WrapDeep(py::object obj, int depth = -1);
   static py::object Unwrap(v8::Handle<v8::Object> obj);
   static void Dispose(v8::Handle<v8::Value> value);
 
+  // call a Python callable with the Javascript arguments packed into one tuple
+  static py::object Apply(PyObject *callable, const v8::FunctionCallbackInfo<v8::Value> &info);
+
   static void ThrowIf(v8::Isolate *isolate);
 };
 
+//
+// Per-isolate bidirectional cache of the property names, owned by the CObjectTemplateCache.
+//
+// The interned Python strings are mapped to the persistent internalized V8 strings and back,
+// so the attribute access from either side skips the UTF-8 transcoding and the allocations.
+// At most MAX_NAMES names are kept, a full cache evicts the names not used since the last sweep of a CLOCK hand,
+// so a pass over computed keys can't push out the hot names for good.
+//
+class CPropertyNameCache : private boost::noncopyable
+{
+  struct Entry
+  {
+    py::object name;
+    v8::Persistent<v8::String> str;
+    int hash;
+    bool referenced;
+
+    ~Entry() { str.Reset(); }
+  };
+
+  typedef boost::shared_ptr<Entry> EntryPtr;
+
+  v8::Isolate *m_isolate;
+
+  std::unordered_map<PyObject *, EntryPtr> m_py_names;  // keyed by the identity of the interned string
+  std::unordered_multimap<int, EntryPtr> m_js_names;    // keyed by the hash of the V8 string
+
+  std::vector<EntryPtr> m_clock;
+  size_t m_hand;
+
+  void Insert(py::object name, v8::Local<v8::String> str);
+  void Evict(EntryPtr entry);
+public:
+  static const size_t MAX_NAMES = 1024;
+
+  CPropertyNameCache(v8::Isolate *isolate) : m_isolate(isolate), m_hand(0) {}
+
+  // the V8 string of a Python attribute name, raise TypeError if it isn't a string
+  v8::Local<v8::String> Get(py::object name);
+
+  // the interned Python string of a V8 property name
+  py::object Get(v8::Local<v8::String> name);
+
+  size_t GetSize(void) const { return m_py_names.size(); }
+};
+
+//
+// Per-isolate cache of the templates specialized for the Python types.
+//
+// The members found in the class dict of a type are registered as accessors on the prototype.
+// The named interceptor stays masking, so the instance attributes and the results of __getattr__
+// still shadow the names inherited from Object.prototype, e.g. toString or valueOf.
+// The templates are rebuilt when the type version tag changes, e.g. the class was modified,
+// and a type modified too often falls back to the generic template.
+//
+// The types are only weakly referenced, the entries of the released types are swept when the cache grows.
+//
+class CObjectTemplateCache : private boost::noncopyable
+{
+  struct Entry
+  {
+    unsigned int version;
+    size_t rebuilds;
+
+    py::object *type; // the weak reference to the type
+
+    v8::Persistent<v8::FunctionTemplate> tmpl; // empty if the type falls back to the generic template
+
+    Entry(py::object *type) : version(0), rebuilds(0), type(type) {}
+
+    bool IsAlive(void) const { return PyWeakref_GET_OBJECT(type->ptr()) != Py_None; }
+
+    ~Entry() { tmpl.Reset(); }
+  };
+
+  typedef boost::shared_ptr<Entry> EntryPtr;
+  typedef std::map<PyTypeObject *, EntryPtr> EntryMap;
+
+  v8::Isolate *m_isolate;
+  v8::Persistent<v8::ObjectTemplate> m_generic;
+
+  EntryMap m_entries;
+  size_t m_sweep_size;
+
+  // the weak references to the types are referred by the callback data of templates, so they live as long as the isolate
+  std::list<py::object> m_types;
+  std::map<std::string, py::object> m_names;
+
+  CPropertyNameCache m_property_names;
+
+  static bool IsSpecializable(PyTypeObject *type);
+
+  void Build(PyTypeObject *type, EntryPtr entry);
+  void Sweep(void);
+public:
+  static const size_t MAX_MEMBERS = 256;
+  static const size_t MAX_REBUILDS = 8;
+
+  CObjectTemplateCache(v8::Isolate *isolate);
+  ~CObjectTemplateCache();
+
+  v8::Local<v8::ObjectTemplate> Generic(void);
+  v8::Local<v8::ObjectTemplate> Get(PyTypeObject *type);
+
+  PyObject *Intern(const char *name);
+
+  CPropertyNameCache &PropertyNames(void) { return m_property_names; }
+
+  size_t GetSize(void) const { return m_entries.size(); }
+};
+
 struct ILazyObject
 {
   virtual void LazyConstructor(void) = 0;
@@ -60,30 +208,28 @@ struct ILazyObject
 class CJavascriptObject
 {
 protected:
+  v8::Isolate *m_isolate;
   v8::Persistent<v8::Object> m_obj;
 
   void CheckAttr(v8::Handle<v8::String> name) const;
 
-  CJavascriptObject()
+  CJavascriptObject() : m_isolate(v8::Isolate::GetCurrent())
   {
   }
 
 public:
   CJavascriptObject(v8::Handle<v8::Object> obj)
-      : m_obj(v8::Isolate::GetCurrent(), obj)
+      : m_isolate(v8::Isolate::GetCurrent()), m_obj(m_isolate, obj)
   {
   }
 
-  virtual ~CJavascriptObject()
-  {
-    m_obj.Reset();
-  }
+  virtual ~CJavascriptObject();
 
   v8::Local<v8::Object> Object(void) const { return v8::Local<v8::Object>::New(v8::Isolate::GetCurrent(), m_obj); }
 
-  py::object GetAttr(const std::string &name);
-  void SetAttr(const std::string &name, py::object value);
-  void DelAttr(const std::string &name);
+  py::object GetAttr(py::object name);
+  void SetAttr(py::object name, py::object value);
+  void DelAttr(py::object name);
 
   py::list GetAttrList(void);
 
@@ -101,7 +247,22 @@ public:
 
   void Dump(std::ostream &os) const;
 
-  static py::object Wrap(CJavascriptObject *obj);
+  // the context in which the object was created, it doesn't require an entered context
+  py::object GetContext(void) const;
+
+  py::object ToPython(int depth, bool cycles);
+  py::object ToJSON(void);
+  static py::object FromPython(py::object obj, int depth);
+
+  // the wrapper and its shared_ptr control block are allocated in one chunk from a free-list pool
+  template <typename T, typename... Args>
+  static boost::shared_ptr<T> Create(Args &&... args)
+  {
+    return boost::allocate_shared<T>(boost::fast_pool_allocator<T>(), std::forward<Args>(args)...);
+  }
+
+  static py::object Wrap(CJavascriptObject *obj) { return Wrap(CJavascriptObjectPtr(obj)); }
+  static py::object Wrap(CJavascriptObjectPtr obj);
   static py::object Wrap(v8::Handle<v8::Value> value,
                          v8::Handle<v8::Object> self = v8::Handle<v8::Object>());
   static py::object Wrap(v8::Handle<v8::Object> obj,
@@ -176,6 +337,7 @@ class CJavascriptFunction : public CJavascriptObject
   v8::Persistent<v8::Object> m_self;
 
   py::object Call(v8::Handle<v8::Object> self, py::list args, py::dict kwds);
+  py::list Batch(py::object iterable, size_t chunk, bool collect_errors, bool spread);
 
 public:
   CJavascriptFunction(v8::Handle<v8::Object> self, v8::Handle<v8::Function> func)
@@ -183,10 +345,7 @@ public:
   {
   }
 
-  ~CJavascriptFunction()
-  {
-    m_self.Reset();
-  }
+  ~CJavascriptFunction();
 
   v8::Handle<v8::Object> Self(void) const { return v8::Local<v8::Object>::New(v8::Isolate::GetCurrent(), m_self); }
 
@@ -197,6 +356,9 @@ public:
   py::object ApplyPython(py::object self, py::list args, py::dict kwds);
   py::object Invoke(py::list args, py::dict kwds);
 
+  py::list Map(py::object iterable, size_t chunk, bool collect_errors);
+  py::list CallMany(py::object args, bool collect_errors);
+
   const std::string GetName(void) const;
   void SetName(const std::string &name);
 
@@ -210,32 +372,136 @@ public:
   py::object GetOwner(void) const;
 };
 
+//
+// A Javascript Promise, Python may chain the callbacks to it, or await it from asyncio.
+//
+class CJavascriptPromise : public CJavascriptObject
+{
+public:
+  CJavascriptPromise(v8::Handle<v8::Promise> promise)
+      : CJavascriptObject(promise)
+  {
+  }
+
+  v8::Promise::PromiseState GetState(void) const;
+  py::object GetResult(void) const;
+
+  py::object Then(py::object on_fulfilled, py::object on_rejected);
+};
+
+//
+// The backing store of a Javascript ArrayBuffer or ArrayBufferView, exported to Python with the buffer protocol.
+//
+// The wrapped object is held until the last memoryview over it is released, so the memory stays valid.
+//
+class CJavascriptArrayBuffer : public CJavascriptObject
+{
+  Py_ssize_t m_itemsize;
+  Py_ssize_t m_shape;
+  const char *m_format;
+
+  size_t m_exports;   // the buffer can't be neutered while it's exported
+  bool m_neuterable;
+
+  v8::Local<v8::ArrayBuffer> Buffer(void) const;
+
+  static int GetBuffer(PyObject *exporter, Py_buffer *view, int flags);
+  static void ReleaseBuffer(PyObject *exporter, Py_buffer *view);
+
+  static PyBufferProcs s_buffer_procs;
+
+public:
+  CJavascriptArrayBuffer(v8::Handle<v8::Object> obj);
+
+  static void Expose(void);
+
+  static py::object Wrap(v8::Handle<v8::Object> obj);
+};
+
 #ifdef SUPPORT_TRACE_LIFECYCLE
 
 class ObjectTracer;
 
-typedef std::map<PyObject *, ObjectTracer *> LivingMap;
+//
+// The identity table from the wrapped Python objects to their tracers, one per context.
+//
+// Open addressing with linear probing and backward shift deletion, a lookup hashes the pointer
+// and compares a few slots without any allocation.
+//
+class CLivingMap : private boost::noncopyable
+{
+  typedef std::pair<PyObject *, ObjectTracer *> slot_t;
+
+  static const size_t INITIAL_CAPACITY = 64;
+
+  std::vector<slot_t> m_slots;
+  size_t m_size;
+
+  size_t Index(PyObject *key) const
+  {
+    uint64_t hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(key)) * 0x9E3779B97F4A7C15ULL;
+
+    return static_cast<size_t>(hash >> 32) & (m_slots.size() - 1);
+  }
+
+  void Grow(void);
+
+public:
+  CLivingMap() : m_slots(INITIAL_CAPACITY), m_size(0) {}
+
+  size_t Size(void) const { return m_size; }
+
+  ObjectTracer *Find(PyObject *key) const
+  {
+    for (size_t i = Index(key);; i = (i + 1) & (m_slots.size() - 1))
+    {
+      if (m_slots[i].first == key) return m_slots[i].second;
+      if (!m_slots[i].first) return NULL;
+    }
+  }
+
+  // keeps the existing tracer if the object has been traced
+  void Insert(PyObject *key, ObjectTracer *tracer);
+
+  // removes the object only if it is traced by the tracer
+  void Erase(PyObject *key, ObjectTracer *tracer);
+
+  template <typename F>
+  void ForEach(F f) const
+  {
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+      if (m_slots[i].first) f(m_slots[i].second);
+    }
+  }
+};
 
 class ObjectTracer
 {
   v8::Persistent<v8::Value> m_handle;
   std::auto_ptr<py::object> m_object;
 
-  LivingMap *m_living;
+  CLivingMap *m_living;
 
   void Trace(void);
 
   static void WeakCallback(const v8::WeakCallbackInfo<ObjectTracer> &data);
 
-  static LivingMap *GetLivingMapping(v8::Isolate *isolate = NULL);
+  static CLivingMap *GetLivingMapping(v8::Isolate *isolate = NULL);
 
 public:
+  // the tracers are allocated from a slab pool, one per wrapped object
+  static void *operator new(size_t size);
+  static void operator delete(void *p);
+
   ObjectTracer(v8::Handle<v8::Value> handle, py::object *object);
   ~ObjectTracer(void);
 
   const v8::Persistent<v8::Value> &Handle(void) const { return m_handle; }
   py::object *Object(void) const { return m_object.get(); }
 
+  void SetWrapperClassId(uint16_t class_id) { m_handle.SetWrapperClassId(class_id); }
+
   void Dispose(void);
 
   static ObjectTracer &Trace(v8::Handle<v8::Value> handle, py::object *object);
@@ -246,19 +512,21 @@ public:
 class ContextTracer
 {
   v8::Persistent<v8::Context> m_ctxt;
-  std::auto_ptr<LivingMap> m_living;
+  std::auto_ptr<CLivingMap> m_living;
 
   void Trace(void);
 
   static void WeakCallback(const v8::WeakCallbackInfo<ContextTracer> &data);
 
+  static void DisposeTracer(ObjectTracer *tracer);
+
 public:
-  ContextTracer(v8::Handle<v8::Context> ctxt, LivingMap *living);
+  ContextTracer(v8::Handle<v8::Context> ctxt, CLivingMap *living);
   ~ContextTracer(void);
 
   v8::Handle<v8::Context> Context(void) const { return v8::Local<v8::Context>::New(v8::Isolate::GetCurrent(), m_ctxt); }
 
-  static void Trace(v8::Handle<v8::Context> ctxt, LivingMap *living);
+  static void Trace(v8::Handle<v8::Context> ctxt, CLivingMap *living);
 };
 
 #endif